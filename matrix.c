@@ -2,16 +2,32 @@
    Программа для работы с матрицами — однофайловая.
    Поддерживает: ввод, случайная генерация, вывод, сложение, вычитание,
    умножение, транспонирование, детерминант (через Gaussian elimination),
-   обратная матрица (Gauss-Jordan), сохранение/загрузка.
+   обратная матрица (LU), сохранение/загрузка.
+   С -DMATRIX_NO_MAIN собирается как библиотека (C++-обёртка — matrix.hpp).
 */
 
+#define _GNU_SOURCE // pthread_setaffinity_np, CPU_SET, syscall
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <math.h>
-
-#define EPS 1e-12
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h> // _mm_stream_pd для поэлементных операций
+#endif
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
 
 typedef struct {
     size_t rows;
@@ -19,18 +35,714 @@ typedef struct {
     double *data; // contiguous storage: data[i*cols + j]
 } Matrix;
 
+/* ====== Параллельное выполнение ====== */
+
+/* Число рабочих потоков: переменная окружения MATRIX_NUM_THREADS или число ядер.
+   Считается один раз (pthread_once): функцию вызывают и потоки программы,
+   и рабочие потоки пула. Столько потоков будет в пуле; matrix_set_num_threads
+   ограничивает, сколько из них работает. */
+static pthread_once_t num_threads_once = PTHREAD_ONCE_INIT;
+static int num_threads_value = 1;
+static atomic_int num_threads_limit = 0; // 0 — без ограничения
+
+static void num_threads_init(void) {
+    const char *env = getenv("MATRIX_NUM_THREADS");
+    long n = env ? strtol(env, NULL, 10) : 0;
+    if (n <= 0) n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 0) n = 1;
+    if (n > 256) n = 256;
+    num_threads_value = (int)n;
+}
+
+static int max_threads(void) {
+    pthread_once(&num_threads_once, num_threads_init);
+    return num_threads_value;
+}
+
+int matrix_num_threads(void) {
+    int limit = atomic_load_explicit(&num_threads_limit, memory_order_relaxed);
+    return limit ? limit : max_threads();
+}
+
+/* NUMA (только Linux, без libnuma — через sysfs и syscall):
+   число узлов, первый процессор узла, привязка потока к процессору,
+   политика размещения страниц (mbind). На других системах — один узел
+   и пустые операции.
+*/
+#define NUMA_MAX_NODES 64
+#define MPOL_BIND_ 2       // значения из <numaif.h>
+#define MPOL_INTERLEAVE_ 3
+
+/* Читает первое число списка вида "0-3,8" из файла sysfs; -1 — нет файла */
+static long sysfs_list_value(const char *path, int last) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char buf[256];
+    long v = -1;
+    if (fgets(buf, sizeof(buf), f)) {
+        char *p = buf, *end;
+        for (;;) {
+            long x = strtol(p, &end, 10);
+            if (end == p) break;
+            v = x;
+            if (!last) break;
+            p = end;
+            if (*p == '-' || *p == ',') ++p;
+            else break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+/* Число NUMA-узлов (по /sys/devices/system/node/online), один раз */
+static pthread_once_t numa_nodes_once = PTHREAD_ONCE_INIT;
+static int numa_nodes_value = 1;
+
+static void numa_nodes_init(void) {
+    long last = sysfs_list_value("/sys/devices/system/node/online", 1);
+    if (last < 0) last = 0;
+    if (last >= NUMA_MAX_NODES) last = NUMA_MAX_NODES - 1;
+    numa_nodes_value = (int)last + 1;
+}
+
+int matrix_numa_nodes(void) {
+    pthread_once(&numa_nodes_once, numa_nodes_init);
+    return numa_nodes_value;
+}
+
+/* Первый процессор узла или -1 */
+static long numa_node_cpu(int node) {
+    char path[96];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    return sysfs_list_value(path, 0);
+}
+
+/* Привязывает вызывающий поток к процессору; 0 — не удалось */
+static int pin_to_cpu(long cpu) {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) return 0;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET((int)cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return 0;
+#endif
+}
+
+/* k-й процессор из разрешённых процессу (по кругу) или -1 */
+static long allowed_cpu(size_t k) {
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return -1;
+    int count = CPU_COUNT(&set);
+    if (count <= 0) return -1;
+    size_t want = k % (size_t)count;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &set) && want-- == 0) return c;
+#else
+    (void)k;
+#endif
+    return -1;
+}
+
+/* Политика страниц для [p, p + bytes): mode MPOL_BIND_ / MPOL_INTERLEAVE_,
+   mask — битовая маска узлов. Границы выравниваются внутрь до страниц. */
+static int numa_bind(void *p, size_t bytes, int mode, unsigned long mask) {
+#if defined(__linux__) && defined(SYS_mbind)
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t lo = ((uintptr_t)p + page - 1) & ~(page - 1);
+    uintptr_t hi = ((uintptr_t)p + bytes) & ~(page - 1);
+    if (hi <= lo) return 0;
+    return syscall(SYS_mbind, (void *)lo, (unsigned long)(hi - lo), mode, &mask,
+                   (unsigned long)NUMA_MAX_NODES + 1, 0u) == 0;
+#else
+    (void)p; (void)bytes; (void)mode; (void)mask;
+    return 0;
+#endif
+}
+
+/* Скорость чтения (ГБ/с) bytes байт, размещённых на узле mem_node, потоком,
+   привязанным к первому процессору узла cpu_node. Привязка вызывающего
+   потока на время замера меняется и потом восстанавливается.
+   Возвращает -1, если номер узла вне [0, matrix_numa_nodes()) (или не
+   помещается в маску unsigned long), если привязать поток или разместить
+   память не удалось.
+*/
+double matrix_numa_bandwidth(int cpu_node, int mem_node, size_t bytes) {
+    int nodes = matrix_numa_nodes();
+    if (cpu_node < 0 || cpu_node >= nodes || mem_node < 0 || mem_node >= nodes
+        || mem_node >= (int)(sizeof(unsigned long) * CHAR_BIT))
+        return -1.0;
+#ifdef __linux__
+    cpu_set_t saved;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) != 0) return -1.0;
+    if (!pin_to_cpu(numa_node_cpu(cpu_node))) return -1.0;
+    size_t n = bytes / sizeof(double);
+    double *p = NULL, result = -1.0;
+    if (n > 0 && posix_memalign((void **)&p, 4096, n * sizeof(double)) == 0) {
+        // на одном узле mbind не нужен (и может быть недоступен в контейнере)
+        int placed = nodes == 1 || numa_bind(p, n * sizeof(double), MPOL_BIND_, 1ul << mem_node);
+        if (placed) {
+            for (size_t i = 0; i < n; ++i) p[i] = (double)(i & 7);
+            double best = 1e300, sink = 0.0;
+            for (int rep = 0; rep < 5; ++rep) {
+                struct timespec t0, t1;
+                clock_gettime(CLOCK_MONOTONIC, &t0);
+                double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+                size_t i = 0;
+                for (; i + 4 <= n; i += 4) { s0 += p[i]; s1 += p[i + 1]; s2 += p[i + 2]; s3 += p[i + 3]; }
+                for (; i < n; ++i) s0 += p[i];
+                clock_gettime(CLOCK_MONOTONIC, &t1);
+                sink += s0 + s1 + s2 + s3;
+                double dt = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+                if (dt < best) best = dt;
+            }
+            if (sink != -1.0 && best > 0.0) result = (double)(n * sizeof(double)) / best * 1e-9;
+        }
+        free(p);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+    return result;
+#else
+    (void)cpu_node; (void)mem_node; (void)bytes;
+    return -1.0;
+#endif
+}
+
+/* Переменная окружения как флаг: 1/0, либо dflt, если не задана */
+static int env_flag(const char *name, int dflt) {
+    const char *v = getenv(name);
+    if (!v || !*v) return dflt;
+    return strcmp(v, "0") != 0;
+}
+
+/* Общий пул потоков с перехватом работы (work stealing). Создаётся при
+   первом параллельном вызове: matrix_num_threads() - 1 рабочих потоков,
+   у каждого своя очередь (deque) под мьютексом. Владелец кладёт и берёт
+   задачи с конца (LIFO), свободные потоки крадут с начала чужих очередей.
+   Потоки вне пула (в том числе чужие пулы вызывающей программы) кладут
+   задачи в общую очередь 0. Ожидающий завершения поток не спит, а
+   выполняет другие задачи, поэтому вложенные parallel_for не создают
+   новых потоков и не превышают числа ядер.
+   Кроме deque у каждого потока есть кольцо «своих» задач: их берёт только
+   он сам (раньше всего остального), другие потоки их не крадут.
+*/
+#define POOL_DEQUE_CAP 1024
+#define POOL_MINE_CAP 64
+
+typedef struct PoolTask PoolTask;
+
+typedef struct {
+    atomic_size_t pending; // число незавершённых задач группы
+} PoolJoin;
+
+struct PoolTask {
+    void (*run)(PoolTask *t);
+    PoolJoin *join;
+};
+
+typedef struct {
+    pthread_mutex_t mu;
+    PoolTask *items[POOL_DEQUE_CAP];
+    size_t top, bottom; // [top, bottom) — задачи, индексы по модулю ёмкости
+    PoolTask *mine[POOL_MINE_CAP];
+    size_t mtop, mbottom; // свои задачи, FIFO
+    atomic_long nmine;
+} PoolDeque;
+
+static struct {
+    pthread_once_t once;
+    size_t nq;              // очередей: 1 общая + рабочие потоки
+    int pin;                // привязывать рабочих к процессорам
+    PoolDeque *q;
+    atomic_long queued;     // задач во всех deque (без своих)
+    pthread_mutex_t mu;     // для сна и пробуждения
+    pthread_cond_t cv;
+} pool = { PTHREAD_ONCE_INIT, 0, 0, NULL, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static _Thread_local size_t pool_self = 0; // 0 — поток вне пула
+static _Thread_local int pool_depth = 0;   // > 0 — внутри задачи пула
+
+static void pool_notify(void) {
+    pthread_mutex_lock(&pool.mu);
+    pthread_cond_broadcast(&pool.cv);
+    pthread_mutex_unlock(&pool.mu);
+}
+
+/* Кладёт задачу в очередь slot; 0 — очередь полна */
+static int pool_push(PoolTask *t, size_t slot) {
+    PoolDeque *d = &pool.q[slot % pool.nq];
+    pthread_mutex_lock(&d->mu);
+    int ok = d->bottom - d->top < POOL_DEQUE_CAP;
+    if (ok) {
+        d->items[d->bottom++ % POOL_DEQUE_CAP] = t;
+        atomic_fetch_add(&pool.queued, 1);
+    }
+    pthread_mutex_unlock(&d->mu);
+    if (ok) pool_notify();
+    return ok;
+}
+
+/* Кладёт задачу в кольцо своих задач потока slot; 0 — кольцо полно */
+static int pool_push_mine(PoolTask *t, size_t slot) {
+    PoolDeque *d = &pool.q[slot % pool.nq];
+    pthread_mutex_lock(&d->mu);
+    int ok = d->mbottom - d->mtop < POOL_MINE_CAP;
+    if (ok) {
+        d->mine[d->mbottom++ % POOL_MINE_CAP] = t;
+        atomic_fetch_add(&d->nmine, 1);
+    }
+    pthread_mutex_unlock(&d->mu);
+    if (ok) pool_notify();
+    return ok;
+}
+
+/* Рабочий с номером не меньше matrix_num_threads() простаивает:
+   выполняет только уже закреплённые за ним задачи */
+static int pool_active(void) {
+    return pool_self < (size_t)matrix_num_threads();
+}
+
+/* Есть ли работа для этого потока */
+static int pool_has_work(void) {
+    return (atomic_load(&pool.queued) > 0 && pool_active()) || atomic_load(&pool.q[pool_self].nmine) > 0;
+}
+
+/* Сначала свои задачи, затем своя очередь — с конца, иначе кража с начала чужих */
+static PoolTask *pool_take(void) {
+    if (!pool_has_work()) return NULL;
+    PoolDeque *own = &pool.q[pool_self];
+    if (atomic_load(&own->nmine) > 0) {
+        PoolTask *t = NULL;
+        pthread_mutex_lock(&own->mu);
+        if (own->mbottom != own->mtop) t = own->mine[own->mtop++ % POOL_MINE_CAP];
+        pthread_mutex_unlock(&own->mu);
+        if (t) {
+            atomic_fetch_sub(&own->nmine, 1);
+            return t;
+        }
+    }
+    if (!pool_active()) return NULL;
+    for (size_t k = 0; k < pool.nq; ++k) {
+        size_t i = (pool_self + k) % pool.nq;
+        PoolDeque *d = &pool.q[i];
+        PoolTask *t = NULL;
+        pthread_mutex_lock(&d->mu);
+        if (d->bottom != d->top)
+            t = (k == 0) ? d->items[--d->bottom % POOL_DEQUE_CAP] : d->items[d->top++ % POOL_DEQUE_CAP];
+        pthread_mutex_unlock(&d->mu);
+        if (t) {
+            atomic_fetch_sub(&pool.queued, 1);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+static void pool_execute(PoolTask *t) {
+    PoolJoin *j = t->join;
+    pool_depth++;
+    t->run(t);
+    pool_depth--;
+    if (atomic_fetch_sub(&j->pending, 1) == 1) pool_notify();
+}
+
+/* Ждёт завершения группы, выполняя по дороге любые задачи */
+static void pool_wait(PoolJoin *j) {
+    while (atomic_load(&j->pending) > 0) {
+        PoolTask *t = pool_take();
+        if (t) { pool_execute(t); continue; }
+        pthread_mutex_lock(&pool.mu);
+        while (atomic_load(&j->pending) > 0 && !pool_has_work())
+            pthread_cond_wait(&pool.cv, &pool.mu);
+        pthread_mutex_unlock(&pool.mu);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    pool_self = (size_t)(uintptr_t)arg;
+    // рабочий i — на i-м разрешённом процессоре (вызывающий поток не трогаем)
+    if (pool.pin) pin_to_cpu(allowed_cpu(pool_self));
+    for (;;) {
+        PoolTask *t = pool_take();
+        if (t) { pool_execute(t); continue; }
+        pthread_mutex_lock(&pool.mu);
+        while (!pool_has_work()) pthread_cond_wait(&pool.cv, &pool.mu);
+        pthread_mutex_unlock(&pool.mu);
+    }
+    return NULL;
+}
+
+static void pool_init(void) {
+    size_t nq = (size_t)max_threads();
+    PoolDeque *q = calloc(nq, sizeof(PoolDeque));
+    if (!q) return; // пула нет — всё выполняется в вызывающем потоке
+    for (size_t i = 0; i < nq; ++i) pthread_mutex_init(&q[i].mu, NULL);
+    pool.q = q;
+    pool.nq = 1;
+    // по умолчанию — только на машинах с несколькими NUMA-узлами
+    pool.pin = env_flag("MATRIX_PIN_THREADS", matrix_numa_nodes() > 1);
+    for (size_t i = 1; i < nq; ++i) {
+        pthread_t th;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int ok = pthread_create(&th, &attr, pool_worker, (void *)(uintptr_t)i) == 0;
+        pthread_attr_destroy(&attr);
+        if (!ok) break;
+        pool.nq = i + 1;
+    }
+}
+
+/* 1 — пул с рабочими потоками есть */
+static int pool_ready(void) {
+    pthread_once(&pool.once, pool_init);
+    return pool.nq > 1;
+}
+
+/* Сколько потоков пула (включая вызывающий) участвует в следующих вызовах:
+   от 1 до MATRIX_NUM_THREADS; n <= 0 — снова все. Лишние рабочие не
+   завершаются, а спят. Менять между параллельными вызовами — например,
+   для замера масштабируемости в одном процессе. Возвращает новое число. */
+int matrix_set_num_threads(int n) {
+    int max = max_threads();
+    if (n <= 0 || n > max) n = max;
+    atomic_store_explicit(&num_threads_limit, n, memory_order_relaxed);
+    pool_notify(); // проснуться включённым рабочим
+    return n;
+}
+
+/* Запускает задачу в пуле через очередь slot (или сразу, если она полна) */
+static void pool_spawn(PoolTask *t, size_t slot) {
+    if (!pool.q || !pool_push(t, slot)) pool_execute(t);
+}
+
+/* То же, но задачу выполнит только поток slot */
+static void pool_spawn_mine(PoolTask *t, size_t slot) {
+    if (!pool.q || !pool_push_mine(t, slot)) pool_execute(t);
+}
+
+typedef void (*range_fn)(size_t lo, size_t hi, void *ctx);
+
+typedef struct {
+    PoolTask base;
+    range_fn fn;
+    void *ctx;
+    size_t lo, hi;
+} RangeTask;
+
+static void range_task_run(PoolTask *t) {
+    RangeTask *r = (RangeTask *)t;
+    r->fn(r->lo, r->hi, r->ctx);
+}
+
+#define PARALLEL_STACK_CHUNKS 16
+
+/* Делит [0, n) на куски не меньше grain (не больше, чем потоков) и выполняет
+   fn(lo, hi, ctx) в пуле; первый кусок — в вызывающем потоке. Границы
+   кусков зависят только от n, grain и числа потоков.
+   owned = 1 (только для вызова не из задачи пула): кусок [lo, hi) закрепляется за
+   потоком lo·T/n — тем, кому достаётся начало куска при делении [0, n) на
+   все T потоков, — и не крадётся. Так обнуление в matrix_alloc
+   (touch_range), заполнение результатов и строки GEMM по одной и той же
+   доле строк всегда попадают в один поток: его страницы — на его NUMA-узле.
+   Плата — ожидание, если этот поток занят чужой работой.
+*/
+static void parallel_run(size_t n, size_t grain, range_fn fn, void *ctx, int owned) {
+    if (n == 0) return;
+    if (grain == 0) grain = 1;
+    size_t nt = (size_t)matrix_num_threads();
+    size_t chunks = (n + grain - 1) / grain;
+    if (chunks > nt) chunks = nt;
+    if (chunks <= 1 || !pool_ready()) { fn(0, n, ctx); return; }
+    RangeTask stack_tasks[PARALLEL_STACK_CHUNKS];
+    RangeTask *tasks = chunks <= PARALLEL_STACK_CHUNKS ? stack_tasks : malloc(chunks * sizeof(RangeTask));
+    if (!tasks) { fn(0, n, ctx); return; }
+    PoolJoin join;
+    atomic_init(&join.pending, chunks - 1);
+    for (size_t c = 0; c < chunks; ++c) {
+        tasks[c].base.run = range_task_run;
+        tasks[c].base.join = &join;
+        tasks[c].fn = fn;
+        tasks[c].ctx = ctx;
+        tasks[c].lo = n * c / chunks;
+        tasks[c].hi = n * (c + 1) / chunks;
+    }
+    if (owned && pool_depth == 0) {
+        for (size_t c = chunks; c-- > 1;) pool_spawn_mine(&tasks[c].base, tasks[c].lo * nt / n);
+    } else {
+        for (size_t c = chunks; c-- > 1;) pool_spawn(&tasks[c].base, (pool_self + c) % nt);
+    }
+    fn(tasks[0].lo, tasks[0].hi, ctx);
+    pool_wait(&join);
+    if (tasks != stack_tasks) free(tasks);
+}
+
+static void parallel_for(size_t n, size_t grain, range_fn fn, void *ctx) {
+    parallel_run(n, grain, fn, ctx, 0);
+}
+
+/* Куски закреплены за потоками (см. parallel_run) */
+static void parallel_for_owned(size_t n, size_t grain, range_fn fn, void *ctx) {
+    parallel_run(n, grain, fn, ctx, 1);
+}
+
+/* Граф задач с зависимостями поверх пула: задача становится готовой, когда
+   выполнены все её предшественники. Готовые задачи лежат в кучах графа по
+   приоритету (меньше — раньше, при равенстве — меньший номер): у каждого
+   потока-владельца своя куча, у задач без владельца — общая. В очереди
+   пула кладутся лишь «жетоны» — в deque владельца (без владельца — того,
+   кто освободил задачу). Какой бы поток ни взял жетон — свой или
+   украденный, — он выполняет лучшую из готовых на этот момент задач его
+   кучи: задачи владельца идут на одном процессоре, критический путь —
+   первым и между разными порциями готовых задач, и при перехвате.
+*/
+typedef void (*task_fn)(size_t task, void *ctx);
+
+typedef struct TaskGraph TaskGraph;
+
+typedef struct {
+    PoolTask base;
+    TaskGraph *g;
+    size_t heap; // из какой кучи брать задачу
+} GraphTask; // жетон: одна готовая задача графа
+
+struct TaskGraph {
+    size_t count;
+    task_fn fn;
+    void *ctx;
+    long *prio;
+    size_t *owner;             // 0 — любой поток, иначе номер потока + 1
+    size_t *ndeps;             // число невыполненных предшественников
+    size_t *from, *to;         // рёбра from -> to
+    size_t nedges, cap;
+    // состояние выполнения
+    size_t *succ_start, *succ; // последователи в CSR
+    size_t nheaps;             // кучи потоков 0..nq-1 и общая nq
+    size_t *heap;              // готовые задачи, кучи по task_before подряд
+    size_t *hstart, *hlen;     // начало и размер кучи h
+    GraphTask *tasks;
+    PoolJoin join;
+    pthread_mutex_t mu;
+};
+
+static TaskGraph *task_graph_create(size_t count, task_fn fn, void *ctx) {
+    TaskGraph *g = calloc(1, sizeof(TaskGraph));
+    if (!g) return NULL;
+    g->count = count;
+    g->fn = fn;
+    g->ctx = ctx;
+    g->prio = calloc(count ? count : 1, sizeof(long));
+    g->owner = calloc(count ? count : 1, sizeof(size_t));
+    g->ndeps = calloc(count ? count : 1, sizeof(size_t));
+    if (!g->prio || !g->owner || !g->ndeps) {
+        free(g->prio); free(g->owner); free(g->ndeps); free(g);
+        return NULL;
+    }
+    return g;
+}
+
+static void task_graph_free(TaskGraph *g) {
+    if (!g) return;
+    free(g->prio); free(g->owner); free(g->ndeps); free(g->from); free(g->to);
+    free(g);
+}
+
+/* Задачу t выполняет поток slot (по модулю числа потоков пула), если он
+   не занят, — иначе её могут украсть */
+static void task_graph_owner(TaskGraph *g, size_t t, size_t slot) {
+    g->owner[t] = slot + 1;
+}
+
+/* Ребро from -> to; возвращает 0 при нехватке памяти */
+static int task_graph_edge(TaskGraph *g, size_t from, size_t to) {
+    if (g->nedges == g->cap) {
+        size_t cap = g->cap ? 2 * g->cap : 64;
+        size_t *f = realloc(g->from, cap * sizeof(size_t));
+        if (!f) return 0;
+        g->from = f;
+        size_t *t = realloc(g->to, cap * sizeof(size_t));
+        if (!t) return 0;
+        g->to = t;
+        g->cap = cap;
+    }
+    g->from[g->nedges] = from;
+    g->to[g->nedges] = to;
+    g->nedges++;
+    g->ndeps[to]++;
+    return 1;
+}
+
+static int task_before(const TaskGraph *g, size_t a, size_t b) {
+    return g->prio[a] < g->prio[b] || (g->prio[a] == g->prio[b] && a < b);
+}
+
+static size_t graph_heap_of(const TaskGraph *g, size_t t) {
+    size_t nq = g->nheaps - 1;
+    return g->owner[t] ? (g->owner[t] - 1) % nq : nq;
+}
+
+/* Кучи готовых задач (под g->mu); задача t кладётся в кучу своего
+   владельца, жетон запоминает кучу */
+static void graph_heap_push(TaskGraph *g, size_t t) {
+    size_t h = graph_heap_of(g, t);
+    size_t *heap = g->heap + g->hstart[h], i = g->hlen[h]++;
+    while (i > 0 && task_before(g, t, heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = t;
+    g->tasks[t].heap = h;
+}
+
+static size_t graph_heap_pop(TaskGraph *g, size_t h) {
+    size_t *heap = g->heap + g->hstart[h], n = --g->hlen[h];
+    size_t best = heap[0], last = heap[n], i = 0;
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= n) break;
+        if (c + 1 < n && task_before(g, heap[c + 1], heap[c])) ++c;
+        if (!task_before(g, heap[c], last)) break;
+        heap[i] = heap[c];
+        i = c;
+    }
+    heap[i] = last;
+    return best;
+}
+
+/* Задачи ready[0..n) уже в кучах: по жетону на каждую в deque владельца */
+static void task_graph_release(TaskGraph *g, const size_t *ready, size_t n) {
+    size_t nq = g->nheaps - 1;
+    for (size_t i = 0; i < n; ++i) {
+        GraphTask *gt = &g->tasks[ready[i]];
+        pool_spawn(&gt->base, gt->heap < nq ? gt->heap : pool_self);
+    }
+}
+
+static void graph_task_run(PoolTask *pt) {
+    GraphTask *gt = (GraphTask *)pt;
+    TaskGraph *g = gt->g;
+    pthread_mutex_lock(&g->mu);
+    size_t id = graph_heap_pop(g, gt->heap); // жетонов кучи не больше, чем её задач
+    pthread_mutex_unlock(&g->mu);
+    g->fn(id, g->ctx);
+    size_t *ready = g->succ + g->succ_start[id], n = 0;
+    size_t cnt = g->succ_start[id + 1] - g->succ_start[id];
+    // последователи переписываются на место: список задачи больше не нужен
+    pthread_mutex_lock(&g->mu);
+    for (size_t e = 0; e < cnt; ++e)
+        if (--g->ndeps[ready[e]] == 0) {
+            graph_heap_push(g, ready[e]);
+            ready[n++] = ready[e];
+        }
+    pthread_mutex_unlock(&g->mu);
+    task_graph_release(g, ready, n);
+}
+
+/* Выполняет все задачи графа (без циклов) в пуле потоков.
+   Возвращает 0 при нехватке памяти — тогда ни одна задача не запускалась.
+*/
+static int task_graph_run(TaskGraph *g) {
+    size_t n = g->count;
+    if (n == 0) return 1;
+    g->succ_start = calloc(n + 1, sizeof(size_t));
+    g->succ = malloc((g->nedges ? g->nedges : 1) * sizeof(size_t));
+    g->tasks = malloc(n * sizeof(GraphTask));
+    pool_ready();
+    size_t active = (size_t)matrix_num_threads();
+    g->nheaps = (pool.nq < active ? (pool.nq ? pool.nq : 1) : active) + 1;
+    g->heap = malloc(n * sizeof(size_t));
+    g->hstart = calloc(g->nheaps + 1, sizeof(size_t));
+    g->hlen = calloc(g->nheaps, sizeof(size_t));
+    size_t *ready = malloc(n * sizeof(size_t));
+    int ok = g->succ_start && g->succ && g->tasks && g->heap && g->hstart && g->hlen && ready;
+    if (ok) {
+        for (size_t e = 0; e < g->nedges; ++e) g->succ_start[g->from[e] + 1]++;
+        for (size_t t = 0; t < n; ++t) g->succ_start[t + 1] += g->succ_start[t];
+        for (size_t e = 0; e < g->nedges; ++e) g->succ[g->succ_start[g->from[e]]++] = g->to[e];
+        for (size_t t = n; t > 0; --t) g->succ_start[t] = g->succ_start[t - 1];
+        g->succ_start[0] = 0;
+        // каждая задача попадает в кучу ровно один раз
+        for (size_t t = 0; t < n; ++t) g->hstart[graph_heap_of(g, t) + 1]++;
+        for (size_t h = 0; h < g->nheaps; ++h) g->hstart[h + 1] += g->hstart[h];
+        pthread_mutex_init(&g->mu, NULL);
+        atomic_init(&g->join.pending, n);
+        size_t nr = 0;
+        for (size_t t = 0; t < n; ++t) {
+            g->tasks[t].base.run = graph_task_run;
+            g->tasks[t].base.join = &g->join;
+            g->tasks[t].g = g;
+            if (g->ndeps[t] == 0) {
+                graph_heap_push(g, t);
+                ready[nr++] = t;
+            }
+        }
+        task_graph_release(g, ready, nr);
+        pool_wait(&g->join);
+        pthread_mutex_destroy(&g->mu);
+    }
+    free(g->succ_start); free(g->succ); free(g->tasks); free(ready);
+    free(g->heap); free(g->hstart); free(g->hlen);
+    g->succ_start = g->succ = g->heap = g->hstart = g->hlen = NULL;
+    g->tasks = NULL;
+    return ok;
+}
+
 /* ====== Вспомогательные функции для работы с матрицами ====== */
 
-Matrix *matrix_create(size_t rows, size_t cols) {
+/* Большие массивы (от NUMA_TOUCH_MIN байт) обнуляются параллельно через
+   parallel_for_owned, как и построчные вычисления: доля строк закреплена за
+   одним потоком, и страница попадает на узел потока, который её первым
+   коснулся и потом обрабатывает. С MATRIX_NUMA=interleave
+   страницы чередуются по всем узлам (mbind до первого касания).
+   Освобождаются обычным free.
+*/
+#define NUMA_TOUCH_MIN (4u << 20)
+
+typedef struct {
+    unsigned char *p;
+    size_t bytes, rows;
+} TouchCtx;
+
+static void touch_range(size_t lo, size_t hi, void *arg) {
+    TouchCtx *t = arg;
+    size_t a = t->bytes * lo / t->rows, b = t->bytes * hi / t->rows;
+    memset(t->p + a, 0, b - a);
+}
+
+/* zero = 0: без обнуления — первым коснётся тот, кто заполнит (тоже по кускам) */
+static void *matrix_alloc(size_t rows, size_t row_bytes, int zero) {
+    if (row_bytes && rows > SIZE_MAX / row_bytes) return NULL;
+    size_t bytes = rows * row_bytes;
+    if (bytes < NUMA_TOUCH_MIN) return calloc(bytes ? bytes : 1, 1);
+    void *p = NULL;
+    if (posix_memalign(&p, 4096, bytes) != 0) return NULL;
+    int nodes = matrix_numa_nodes();
+    const char *mode = getenv("MATRIX_NUMA");
+    if (nodes > 1 && mode && strcmp(mode, "interleave") == 0)
+        numa_bind(p, bytes, MPOL_INTERLEAVE_, nodes >= 64 ? ~0ul : (1ul << nodes) - 1);
+    TouchCtx t = { p, bytes, rows };
+    if (zero) parallel_for_owned(rows, 1, touch_range, &t);
+    return p;
+}
+
+static Matrix *matrix_alloc_struct(size_t rows, size_t cols, int zero) {
     Matrix *m = malloc(sizeof(Matrix));
     if (!m) return NULL;
     m->rows = rows;
     m->cols = cols;
-    m->data = calloc(rows * cols, sizeof(double));
+    m->data = matrix_alloc(rows, cols * sizeof(double), zero);
     if (!m->data) { free(m); return NULL; }
     return m;
 }
 
+Matrix *matrix_create(size_t rows, size_t cols) {
+    return matrix_alloc_struct(rows, cols, 1);
+}
+
 void matrix_free(Matrix *m) {
     if (!m) return;
     free(m->data);
@@ -52,238 +764,5254 @@ void matrix_print(const Matrix *m) {
         for (size_t j = 0; j < m->cols; ++j) {
             printf("%10.4g ", matrix_get(m, i, j));
         }
-        printf("\n");
+        printf("\n");
+    }
+}
+
+/* Ввод матрицы вручную */
+void matrix_input(Matrix *m) {
+    printf("Ввод матрицы %zux%zu (по элементам):\n", m->rows, m->cols);
+    for (size_t i = 0; i < m->rows; ++i) {
+        for (size_t j = 0; j < m->cols; ++j) {
+            double v;
+            printf("A[%zu][%zu] = ", i, j);
+            while (scanf("%lf", &v) != 1) {
+                while (getchar() != '\n'); // чистим ввод
+                printf("Неверный ввод. Попробуйте снова: ");
+            }
+            matrix_set(m, i, j, v);
+        }
+    }
+}
+
+/* Поэлементные операции делятся на куски не меньше ELEM_GRAIN элементов */
+#define ELEM_GRAIN 32768
+
+typedef struct {
+    double *data;
+    uint64_t seed;
+    double minv, scale;
+} RandomCtx;
+
+/* splitmix64: число зависит только от seed и номера элемента */
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static void random_range(size_t lo, size_t hi, void *arg) {
+    RandomCtx *c = arg;
+    for (size_t i = lo; i < hi; ++i)
+        c->data[i] = c->minv + c->scale * ((double)(splitmix64(c->seed + i) >> 11) * 0x1.0p-53);
+}
+
+/* Заполнение случайными числами в диапазоне [minv, maxv).
+   Зерно берётся из rand() (srand задаёт последовательность), элементы —
+   splitmix64(зерно + индекс), поэтому результат не зависит от числа потоков.
+*/
+void matrix_random(Matrix *m, double minv, double maxv) {
+    RandomCtx ctx = { m->data, 0, minv, maxv - minv };
+    ctx.seed = ((uint64_t)rand() << 32) ^ (uint64_t)rand();
+    parallel_for_owned(m->rows * m->cols, ELEM_GRAIN, random_range, &ctx);
+}
+
+/* Копирование */
+Matrix *matrix_clone(const Matrix *a) {
+    Matrix *b = matrix_create(a->rows, a->cols);
+    if (!b) return NULL;
+    memcpy(b->data, a->data, sizeof(double) * a->rows * a->cols);
+    return b;
+}
+
+/* ====== Поэлементные операции ====== */
+
+/* Один проход по непрерывным массивам кусками parallel_for (ELEM_GRAIN).
+   Операция выбирается до цикла, внутренние циклы без ветвлений и
+   векторизуются компилятором. Если результат больше кэша последнего уровня,
+   запись идёт мимо кэша (_mm_stream_pd): строки результата не читаются
+   перед записью и не вытесняют входные данные. Результат выделяется без
+   обнуления — страницы первым касанием размещает сам проход.
+*/
+typedef enum { EW_ADD, EW_SUB, EW_MUL, EW_DIV, EW_SCALE, EW_AXPY, EW_ABS, EW_EXP } ElemOp;
+
+typedef struct {
+    ElemOp op;
+    const double *a, *b;
+    double *c;
+    double s;
+    int stream; // потоковая запись (не для EW_AXPY: там c читается)
+} ElemCtx;
+
+/* Размер кэша последнего уровня; если неизвестен — 8 МиБ */
+static size_t llc_bytes(void) {
+    long v = -1;
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    v = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (v <= 0) v = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return v > 0 ? (size_t)v : (size_t)8 << 20;
+}
+
+/* c[k] = EXPR для k в [lo, hi); EXPR записано через индекс k */
+#if defined(__SSE2__)
+#define ELEM_LOOP(EXPR)                                                        \
+    do {                                                                       \
+        size_t i = lo;                                                         \
+        if (x->stream) {                                                       \
+            for (; i < hi && ((uintptr_t)(c + i) & 15); ++i) { size_t k = i; c[k] = (EXPR); } \
+            for (; i + 8 <= hi; i += 8) {                                      \
+                double v[8];                                                   \
+                for (size_t q = 0; q < 8; ++q) { size_t k = i + q; v[q] = (EXPR); } \
+                for (size_t q = 0; q < 8; q += 2) _mm_stream_pd(c + i + q, _mm_loadu_pd(v + q)); \
+            }                                                                  \
+        }                                                                      \
+        for (; i < hi; ++i) { size_t k = i; c[k] = (EXPR); }                   \
+    } while (0)
+#else
+#define ELEM_LOOP(EXPR)                                                        \
+    do {                                                                       \
+        for (size_t k = lo; k < hi; ++k) c[k] = (EXPR);                        \
+    } while (0)
+#endif
+
+static void elem_range(size_t lo, size_t hi, void *arg) {
+    const ElemCtx *x = arg;
+    // без restrict: c может совпадать с a или b (элемент k читается только из k)
+    const double *a = x->a, *b = x->b;
+    double *c = x->c;
+    double s = x->s;
+    switch (x->op) {
+    case EW_ADD: ELEM_LOOP(a[k] + b[k]); break;
+    case EW_SUB: ELEM_LOOP(a[k] - b[k]); break;
+    case EW_MUL: ELEM_LOOP(a[k] * b[k]); break;
+    case EW_DIV: ELEM_LOOP(a[k] / b[k]); break;
+    case EW_SCALE: ELEM_LOOP(s * a[k]); break;
+    case EW_AXPY: for (size_t k = lo; k < hi; ++k) c[k] += s * a[k]; break;
+    case EW_ABS: ELEM_LOOP(fabs(a[k])); break;
+    case EW_EXP: ELEM_LOOP(exp(a[k])); break;
+    }
+#if defined(__SSE2__)
+    if (x->stream) _mm_sfence(); // потоковые записи видны до завершения куска
+#endif
+}
+
+/* out = op(a[, b]) в уже выделенную матрицу того же размера; out может
+   совпадать с a или b. 0 — размеры не совпадают. */
+static int elem_into(ElemOp op, const Matrix *a, const Matrix *b, double s, Matrix *out) {
+    if (!a || !out || out->rows != a->rows || out->cols != a->cols) return 0;
+    if (b && (a->rows != b->rows || a->cols != b->cols)) return 0;
+    size_t n = a->rows * a->cols;
+    ElemCtx ctx = { op, a->data, b ? b->data : NULL, out->data, s, n * sizeof(double) > llc_bytes() };
+    parallel_for_owned(n, ELEM_GRAIN, elem_range, &ctx);
+    return 1;
+}
+
+/* Новая матрица c = op(a[, b]); b == NULL для унарных операций */
+static Matrix *elem_apply(ElemOp op, const Matrix *a, const Matrix *b, double s) {
+    if (!a) return NULL;
+    if (b && (a->rows != b->rows || a->cols != b->cols)) return NULL;
+    Matrix *c = matrix_alloc_struct(a->rows, a->cols, 0);
+    if (c) elem_into(op, a, b, s, c);
+    return c;
+}
+
+/* Сложение/вычитание */
+Matrix *matrix_add_sub(const Matrix *a, const Matrix *b, int subtract) {
+    if (!b) return NULL;
+    return elem_apply(subtract ? EW_SUB : EW_ADD, a, b, 0.0);
+}
+
+/* Поэлементное (адамарово) произведение и деление */
+Matrix *matrix_hadamard(const Matrix *a, const Matrix *b) {
+    if (!b) return NULL;
+    return elem_apply(EW_MUL, a, b, 0.0);
+}
+
+Matrix *matrix_divide(const Matrix *a, const Matrix *b) {
+    if (!b) return NULL;
+    return elem_apply(EW_DIV, a, b, 0.0);
+}
+
+/* s * A */
+Matrix *matrix_scale(const Matrix *a, double s) {
+    return elem_apply(EW_SCALE, a, NULL, s);
+}
+
+/* |a_ij| и exp(a_ij) */
+Matrix *matrix_abs(const Matrix *a) {
+    return elem_apply(EW_ABS, a, NULL, 0.0);
+}
+
+Matrix *matrix_exp(const Matrix *a) {
+    return elem_apply(EW_EXP, a, NULL, 0.0);
+}
+
+/* parallel_for для внешнего кода (C++-обёртка считает через него слитые
+   поэлементные выражения); grain == 0 — ELEM_GRAIN */
+void matrix_parallel_for(size_t n, size_t grain, void (*fn)(size_t lo, size_t hi, void *ctx), void *ctx) {
+    parallel_for(n, grain ? grain : ELEM_GRAIN, fn, ctx);
+}
+
+/* Варианты с готовым выходом: без выделения и первого касания страниц —
+   так поэлементный проход упирается только в пропускную способность памяти.
+   out может совпадать с a или b; 0 — размеры не совпадают. */
+int matrix_add_sub_into(const Matrix *a, const Matrix *b, int subtract, Matrix *out) {
+    if (!b) return 0;
+    return elem_into(subtract ? EW_SUB : EW_ADD, a, b, 0.0, out);
+}
+
+int matrix_hadamard_into(const Matrix *a, const Matrix *b, Matrix *out) {
+    if (!b) return 0;
+    return elem_into(EW_MUL, a, b, 0.0, out);
+}
+
+int matrix_divide_into(const Matrix *a, const Matrix *b, Matrix *out) {
+    if (!b) return 0;
+    return elem_into(EW_DIV, a, b, 0.0, out);
+}
+
+int matrix_scale_into(const Matrix *a, double s, Matrix *out) {
+    return elem_into(EW_SCALE, a, NULL, s, out);
+}
+
+/* Y += alpha * X на месте; 0 — размеры не совпадают */
+int matrix_axpy(double alpha, const Matrix *x, Matrix *y) {
+    if (!x || !y || x->rows != y->rows || x->cols != y->cols) return 0;
+    ElemCtx ctx = { EW_AXPY, x->data, NULL, y->data, alpha, 0 };
+    parallel_for_owned(x->rows * x->cols, ELEM_GRAIN, elem_range, &ctx);
+    return 1;
+}
+
+/* ====== Свёртки: суммы, минимум/максимум, нормы, след ====== */
+
+/* Полная свёртка идёт блоками по RED_BLOCK элементов, свёртка по столбцам —
+   блоками по RED_ROWS строк; частичные результаты блоков складываются
+   попарным деревом в фиксированном порядке. Разбиение на блоки не зависит
+   от числа потоков, поэтому и результат от него не зависит.
+   Внутри блока — попарное суммирование с 8 независимыми аккумуляторами
+   (ошибка O(log n * eps), цикл векторизуется).
+*/
+typedef enum { MATRIX_SUM, MATRIX_MEAN, MATRIX_MIN, MATRIX_MAX } MatrixReduce;
+
+#define RED_BLOCK 4096
+#define RED_ROWS 64
+#define RED_LEAF 256 // до этой длины — прямой проход аккумуляторами
+
+typedef enum { RED_PLAIN, RED_ABS, RED_SQUARE } RedMap;
+
+static double sum_leaf(const double *x, size_t n, RedMap map) {
+    double acc[8] = {0};
+    size_t i = 0;
+    switch (map) {
+    case RED_PLAIN:
+        for (; i + 8 <= n; i += 8)
+            for (size_t q = 0; q < 8; ++q) acc[q] += x[i + q];
+        for (; i < n; ++i) acc[0] += x[i];
+        break;
+    case RED_ABS:
+        for (; i + 8 <= n; i += 8)
+            for (size_t q = 0; q < 8; ++q) acc[q] += fabs(x[i + q]);
+        for (; i < n; ++i) acc[0] += fabs(x[i]);
+        break;
+    case RED_SQUARE:
+        for (; i + 8 <= n; i += 8)
+            for (size_t q = 0; q < 8; ++q) acc[q] += x[i + q] * x[i + q];
+        for (; i < n; ++i) acc[0] += x[i] * x[i];
+        break;
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+/* Попарная сумма map(x[0..n)) */
+static double sum_pairwise(const double *x, size_t n, RedMap map) {
+    if (n <= RED_LEAF) return sum_leaf(x, n, map);
+    size_t h = (n / 2 + 7) & ~(size_t)7; // половины кратны 8
+    return sum_pairwise(x, h, map) + sum_pairwise(x + h, n - h, map);
+}
+
+static double minmax_run(const double *x, size_t n, int want_max, RedMap map) {
+    double m = map == RED_ABS ? fabs(x[0]) : x[0];
+    for (size_t i = 1; i < n; ++i) {
+        double v = map == RED_ABS ? fabs(x[i]) : x[i];
+        if (want_max ? v > m : v < m) m = v;
+    }
+    return m;
+}
+
+/* Попарное дерево над частичными суммами (по месту) */
+static double sum_tree(double *p, size_t n) {
+    if (n == 0) return 0.0;
+    for (size_t step = 1; step < n; step *= 2)
+        for (size_t b = 0; b + step < n; b += 2 * step) p[b] += p[b + step];
+    return p[0];
+}
+
+typedef struct {
+    const double *a;
+    size_t n, rows, cols;
+    MatrixReduce op;
+    RedMap map;
+    double *part; // по одному на блок (полная) или cols на блок (по столбцам)
+} RedCtx;
+
+static void red_all_blocks(size_t lo, size_t hi, void *arg) {
+    RedCtx *r = arg;
+    for (size_t b = lo; b < hi; ++b) {
+        size_t s = b * RED_BLOCK, len = (r->n - s < RED_BLOCK) ? r->n - s : RED_BLOCK;
+        if (r->op == MATRIX_MIN || r->op == MATRIX_MAX)
+            r->part[b] = minmax_run(r->a + s, len, r->op == MATRIX_MAX, r->map);
+        else
+            r->part[b] = sum_pairwise(r->a + s, len, r->map);
+    }
+}
+
+/* Свёртка всех элементов map(a_ij); NAN для пустой матрицы (кроме суммы) */
+static double reduce_all(const Matrix *a, MatrixReduce op, RedMap map) {
+    if (!a) return NAN;
+    size_t n = a->rows * a->cols;
+    if (n == 0) return op == MATRIX_SUM ? 0.0 : NAN;
+    size_t nb = (n + RED_BLOCK - 1) / RED_BLOCK;
+    double one, *part = nb == 1 ? &one : malloc(nb * sizeof(double));
+    if (!part) return NAN;
+    RedCtx r = { a->data, n, a->rows, a->cols, op, map, part };
+    parallel_for(nb, 1, red_all_blocks, &r);
+    double res;
+    if (op == MATRIX_MIN || op == MATRIX_MAX) {
+        res = part[0];
+        for (size_t b = 1; b < nb; ++b)
+            if (op == MATRIX_MAX ? part[b] > res : part[b] < res) res = part[b];
+    } else {
+        res = sum_tree(part, nb);
+        if (op == MATRIX_MEAN) res /= (double)n;
+    }
+    if (part != &one) free(part);
+    return res;
+}
+
+static void red_rows(size_t lo, size_t hi, void *arg) {
+    RedCtx *r = arg;
+    for (size_t i = lo; i < hi; ++i) {
+        const double *row = r->a + i * r->cols;
+        if (r->op == MATRIX_MIN || r->op == MATRIX_MAX)
+            r->part[i] = minmax_run(row, r->cols, r->op == MATRIX_MAX, r->map);
+        else
+            r->part[i] = sum_pairwise(row, r->cols, r->map) / (r->op == MATRIX_MEAN ? (double)r->cols : 1.0);
+    }
+}
+
+/* Блок строк [b * RED_ROWS, ...): частичный вектор по столбцам */
+static void red_col_blocks(size_t lo, size_t hi, void *arg) {
+    RedCtx *r = arg;
+    int mm = r->op == MATRIX_MIN || r->op == MATRIX_MAX, mx = r->op == MATRIX_MAX;
+    for (size_t b = lo; b < hi; ++b) {
+        double *p = r->part + b * r->cols;
+        size_t i0 = b * RED_ROWS, i1 = (r->rows - i0 < RED_ROWS) ? r->rows : i0 + RED_ROWS;
+        const double *row = r->a + i0 * r->cols;
+        for (size_t j = 0; j < r->cols; ++j) p[j] = r->map == RED_ABS ? fabs(row[j]) : row[j];
+        for (size_t i = i0 + 1; i < i1; ++i) {
+            row = r->a + i * r->cols;
+            if (mm) {
+                for (size_t j = 0; j < r->cols; ++j) {
+                    double v = r->map == RED_ABS ? fabs(row[j]) : row[j];
+                    if (mx ? v > p[j] : v < p[j]) p[j] = v;
+                }
+            } else if (r->map == RED_ABS) {
+                for (size_t j = 0; j < r->cols; ++j) p[j] += fabs(row[j]);
+            } else {
+                for (size_t j = 0; j < r->cols; ++j) p[j] += row[j];
+            }
+        }
+    }
+}
+
+/* axis = 1: по строкам, результат rows x 1; axis = 0: по столбцам, 1 x cols */
+static Matrix *reduce_axis(const Matrix *a, int axis, MatrixReduce op, RedMap map) {
+    if (!a || (axis != 0 && axis != 1)) return NULL;
+    Matrix *res = axis ? matrix_create(a->rows, 1) : matrix_create(1, a->cols);
+    if (!res) return NULL;
+    RedCtx r = { a->data, a->rows * a->cols, a->rows, a->cols, op, map, res->data };
+    if (axis == 1) {
+        if (a->cols == 0) {
+            for (size_t i = 0; i < a->rows; ++i) res->data[i] = op == MATRIX_SUM ? 0.0 : NAN;
+            return res;
+        }
+        parallel_for(a->rows, 1 + RED_BLOCK / a->cols, red_rows, &r);
+        return res;
+    }
+    if (a->rows == 0) {
+        for (size_t j = 0; j < a->cols; ++j) res->data[j] = op == MATRIX_SUM ? 0.0 : NAN;
+        return res;
+    }
+    size_t nb = (a->rows + RED_ROWS - 1) / RED_ROWS, c = a->cols;
+    size_t cnt = nb * c;
+    r.part = malloc((cnt ? cnt : 1) * sizeof(double));
+    if (!r.part) { matrix_free(res); return NULL; }
+    parallel_for(nb, 1, red_col_blocks, &r);
+    int mm = op == MATRIX_MIN || op == MATRIX_MAX;
+    // дерево по блокам: тот же порядок при любом числе потоков
+    for (size_t step = 1; step < nb; step *= 2)
+        for (size_t b = 0; b + step < nb; b += 2 * step) {
+            double *p = r.part + b * c, *q = r.part + (b + step) * c;
+            for (size_t j = 0; j < c; ++j) {
+                if (!mm) p[j] += q[j];
+                else if (op == MATRIX_MAX ? q[j] > p[j] : q[j] < p[j]) p[j] = q[j];
+            }
+        }
+    for (size_t j = 0; j < c; ++j)
+        res->data[j] = op == MATRIX_MEAN ? r.part[j] / (double)a->rows : r.part[j];
+    free(r.part);
+    return res;
+}
+
+/* Сумма, среднее, минимум или максимум по строкам (axis = 1, результат
+   rows x 1) или по столбцам (axis = 0, результат 1 x cols). */
+Matrix *matrix_reduce(const Matrix *a, int axis, MatrixReduce op) {
+    return reduce_axis(a, axis, op, RED_PLAIN);
+}
+
+/* Та же свёртка по всем элементам; NAN для пустой матрицы (сумма — 0) */
+double matrix_reduce_all(const Matrix *a, MatrixReduce op) {
+    return reduce_all(a, op, RED_PLAIN);
+}
+
+/* Нормы: '1' — max сумма |a_ij| по столбцам, 'I' — по строкам,
+   'F' — Фробениуса, 'M' — max |a_ij|. NAN при неверном аргументе.
+   Для 'F' сумма квадратов при переполнении или потере порядка
+   пересчитывается с масштабом max |a_ij|.
+*/
+double matrix_norm(const Matrix *a, char type) {
+    if (!a) return NAN;
+    if (a->rows * a->cols == 0) return 0.0;
+    switch (type) {
+    case '1':
+    case 'I': {
+        Matrix *s = reduce_axis(a, type == 'I', MATRIX_SUM, RED_ABS);
+        double r = s ? reduce_all(s, MATRIX_MAX, RED_PLAIN) : NAN;
+        matrix_free(s);
+        return r;
+    }
+    case 'M':
+        return reduce_all(a, MATRIX_MAX, RED_ABS);
+    case 'F': {
+        double ss = reduce_all(a, MATRIX_SUM, RED_SQUARE);
+        if (isfinite(ss) && ss > DBL_MIN / DBL_EPSILON) return sqrt(ss);
+        double m = reduce_all(a, MATRIX_MAX, RED_ABS);
+        if (m == 0.0 || !isfinite(m)) return m;
+        Matrix *s = matrix_scale(a, 1.0 / m);
+        double r = s ? m * sqrt(reduce_all(s, MATRIX_SUM, RED_SQUARE)) : NAN;
+        matrix_free(s);
+        return r;
+    }
+    default:
+        return NAN;
+    }
+}
+
+/* След (сумма диагонали, попарно); NAN для неквадратной матрицы */
+double matrix_trace(const Matrix *a) {
+    if (!a || a->rows != a->cols) return NAN;
+    size_t n = a->rows;
+    double *d = malloc((n ? n : 1) * sizeof(double));
+    if (!d) return NAN;
+    for (size_t i = 0; i < n; ++i) d[i] = a->data[i * n + i];
+    double t = sum_pairwise(d, n, RED_PLAIN);
+    free(d);
+    return t;
+}
+
+/* ====== Ядра для малых матриц фиксированного размера (n <= 8) ====== */
+
+/* Для n <= SMALL_N_MAX matrix_multiply (квадратные n x n), matrix_transpose,
+   matrix_determinant и matrix_inverse вызывают версии, в которых n —
+   константа: одно тело small_*_body подставляется (always_inline) для
+   N = 1..8 макросом SMALL_KERNELS, циклы полностью разворачиваются, рабочие
+   массивы лежат на стеке, malloc нет.
+   Эталон — сами обобщённые алгоритмы, и результат побитово совпадает с ними:
+     умножение    — c_ij = (((0 + a_i0 b_0j) + a_i1 b_1j) + ...), k по возрастанию,
+                    как в matrix_gemm;
+     детерминант  — lu_factor (частичный выбор, первый максимум |a_rk|, r >= k)
+                    и det_accumulate по диагонали U;
+     обратная     — lu_factor и lu_inverse_inplace при n <= LU_NB: U^-1 по
+                    столбцам (tri_upper_inverse), X L = U^-1 одним блоком
+                    справа налево, перестановка столбцов в обратном порядке;
+   порог вырожденности — singular_tol. Операции и их порядок те же,
+   меняется только то, что компилятор знает n.
+*/
+#define SMALL_N_MAX 8
+
+#if defined(__GNUC__)
+#define SMALL_INLINE static inline __attribute__((always_inline))
+#define SMALL_UNROLL _Pragma("GCC unroll 16")
+#else
+#define SMALL_INLINE static inline
+#define SMALL_UNROLL
+#endif
+
+SMALL_INLINE void small_mul_body(const double *a, const double *b, double *c, size_t n) {
+    SMALL_UNROLL
+    for (size_t i = 0; i < n; ++i) {
+        double row[SMALL_N_MAX];
+        SMALL_UNROLL
+        for (size_t j = 0; j < n; ++j) row[j] = 0.0;
+        SMALL_UNROLL
+        for (size_t p = 0; p < n; ++p) {
+            double x = a[i * n + p];
+            SMALL_UNROLL
+            for (size_t j = 0; j < n; ++j) row[j] += x * b[p * n + j];
+        }
+        SMALL_UNROLL
+        for (size_t j = 0; j < n; ++j) c[i * n + j] = row[j];
+    }
+}
+
+SMALL_INLINE void small_transpose_body(const double *a, double *t, size_t n) {
+    SMALL_UNROLL
+    for (size_t i = 0; i < n; ++i)
+        SMALL_UNROLL
+        for (size_t j = 0; j < n; ++j) t[j * n + i] = a[i * n + j];
+}
+
+SMALL_INLINE int small_lu_body(double *a, size_t n, size_t *piv, double tol) {
+    SMALL_UNROLL
+    for (size_t i = 0; i < n; ++i) {
+        size_t p = i;
+        SMALL_UNROLL
+        for (size_t r = i; r < n; ++r)
+            if (fabs(a[r * n + i]) > fabs(a[p * n + i])) p = r;
+        piv[i] = p;
+        if (!(fabs(a[p * n + i]) > tol)) return 0;
+        if (p != i) {
+            SMALL_UNROLL
+            for (size_t c = 0; c < n; ++c) {
+                double tmp = a[i * n + c];
+                a[i * n + c] = a[p * n + c];
+                a[p * n + c] = tmp;
+            }
+        }
+        double pivot = a[i * n + i];
+        SMALL_UNROLL
+        for (size_t r = i + 1; r < n; ++r) {
+            double factor = a[r * n + i] / pivot;
+            a[r * n + i] = factor;
+            SMALL_UNROLL
+            for (size_t c = i + 1; c < n; ++c)
+                a[r * n + c] -= factor * a[i * n + c];
+        }
+    }
+    return 1;
+}
+
+SMALL_INLINE int small_inverse_body(const double *a, double *inv, size_t n, double tol) {
+    size_t piv[SMALL_N_MAX];
+    double w[SMALL_N_MAX * SMALL_N_MAX];
+    SMALL_UNROLL
+    for (size_t k = 0; k < n * n; ++k) inv[k] = a[k];
+    if (!small_lu_body(inv, n, piv, tol)) return 0;
+    // U -> U^-1 (tri_upper_inverse при n <= LU_NB)
+    SMALL_UNROLL
+    for (size_t j = 0; j < n; ++j) {
+        if (inv[j * n + j] == 0.0) return 0;
+        inv[j * n + j] = 1.0 / inv[j * n + j];
+    }
+    SMALL_UNROLL
+    for (size_t j = 1; j < n; ++j)
+        SMALL_UNROLL
+        for (size_t i = 0; i < j; ++i) {
+            double s = 0.0;
+            SMALL_UNROLL
+            for (size_t p = i; p < j; ++p) s += inv[i * n + p] * inv[p * n + j];
+            inv[i * n + j] = -inv[j * n + j] * s;
+        }
+    // X L = U^-1 (lu_inverse_inplace, один блок): L — в w, в inv — нули
+    SMALL_UNROLL
+    for (size_t i = 0; i < n; ++i)
+        SMALL_UNROLL
+        for (size_t c = 0; c < n; ++c) {
+            w[i * n + c] = i > c ? inv[i * n + c] : 0.0;
+            if (i > c) inv[i * n + c] = 0.0;
+        }
+    SMALL_UNROLL
+    for (size_t i = 0; i < n; ++i)
+        SMALL_UNROLL
+        for (size_t c = n; c-- > 0;)
+            SMALL_UNROLL
+            for (size_t t = c + 1; t < n; ++t) inv[i * n + c] -= inv[i * n + t] * w[t * n + c];
+    // столбцы в обратном порядке перестановок
+    SMALL_UNROLL
+    for (size_t j = n; j-- > 0;) {
+        if (piv[j] == j) continue;
+        SMALL_UNROLL
+        for (size_t i = 0; i < n; ++i) {
+            double t = inv[i * n + j];
+            inv[i * n + j] = inv[i * n + piv[j]];
+            inv[i * n + piv[j]] = t;
+        }
+    }
+    return 1;
+}
+
+typedef struct {
+    void (*mul)(const double *a, const double *b, double *c);
+    void (*transpose)(const double *a, double *t);
+    int (*lu)(double *a, size_t *piv, double tol);
+    int (*inverse)(const double *a, double *inv, double tol);
+} SmallKernels;
+
+#define SMALL_KERNELS(N) \
+    static void small_mul_##N(const double *a, const double *b, double *c) { small_mul_body(a, b, c, N); } \
+    static void small_transpose_##N(const double *a, double *t) { small_transpose_body(a, t, N); } \
+    static int small_lu_##N(double *a, size_t *piv, double tol) { return small_lu_body(a, N, piv, tol); } \
+    static int small_inverse_##N(const double *a, double *inv, double tol) { return small_inverse_body(a, inv, N, tol); }
+
+SMALL_KERNELS(1)
+SMALL_KERNELS(2)
+SMALL_KERNELS(3)
+SMALL_KERNELS(4)
+SMALL_KERNELS(5)
+SMALL_KERNELS(6)
+SMALL_KERNELS(7)
+SMALL_KERNELS(8)
+
+#define SMALL_ENTRY(N) { small_mul_##N, small_transpose_##N, small_lu_##N, small_inverse_##N }
+
+static const SmallKernels small_kernels[SMALL_N_MAX + 1] = {
+    { NULL, NULL, NULL, NULL },
+    SMALL_ENTRY(1), SMALL_ENTRY(2), SMALL_ENTRY(3), SMALL_ENTRY(4),
+    SMALL_ENTRY(5), SMALL_ENTRY(6), SMALL_ENTRY(7), SMALL_ENTRY(8)
+};
+
+/* Ядро умножения: C = alpha * op(A) * op(B) + beta * C.
+   Все матрицы построчные, ld* — шаг строки, op(X) = X или X^T (ta/tb = 0/1).
+   Блок op(B) копируется в непрерывный буфер, поэтому транспонирование
+   не требует отдельной копии всей матрицы, а внутренний цикл идёт по
+   непрерывной строке C. Порядок суммирования по k — как в наивном цикле.
+*/
+#define GEMM_MC 64
+#define GEMM_KC 256
+#define GEMM_NC 512
+#define GEMM_PAR_MIN (1u << 20) // m * nc * kc, с которого блоки строк идут в пул
+
+typedef struct {
+    int ta;
+    double alpha;
+    const double *A;
+    size_t lda;
+    const double *pb; // упакованный блок op(B) kc x nc
+    double *C;
+    size_t ldc, m, jc, nc, pc, kc;
+} GemmCtx;
+
+static void gemm_row_blocks(size_t lo, size_t hi, void *arg) {
+    const GemmCtx *g = arg;
+    for (size_t ic = lo * GEMM_MC; ic < hi * GEMM_MC && ic < g->m; ic += GEMM_MC) {
+        size_t mc = (g->m - ic < GEMM_MC) ? g->m - ic : GEMM_MC;
+        for (size_t i = ic; i < ic + mc; ++i) {
+            double *c = g->C + i * g->ldc + g->jc;
+            for (size_t p = 0; p < g->kc; ++p) {
+                size_t q = g->pc + p;
+                double a = g->alpha * (g->ta ? g->A[q * g->lda + i] : g->A[i * g->lda + q]);
+                const double *b = g->pb + p * g->nc;
+                for (size_t j = 0; j < g->nc; ++j) c[j] += a * b[j];
+            }
+        }
+    }
+}
+
+/* Длина буфера упаковки B (в double) для gemm_packed при данных n и k */
+static size_t gemm_pack_len(size_t n, size_t k) {
+    return (k < GEMM_KC ? k : GEMM_KC) * (n < GEMM_NC ? n : GEMM_NC);
+}
+
+/* matrix_gemm с буфером упаковки вызывающего (gemm_pack_len(n, k) элементов):
+   для повторяющихся умножений (степень, exp) без malloc на каждое.
+   pb == NULL — без упаковки. */
+static void gemm_packed(int ta, int tb, size_t m, size_t n, size_t k,
+                        double alpha, const double *A, size_t lda,
+                        const double *B, size_t ldb,
+                        double beta, double *C, size_t ldc, double *pb) {
+    if (m == 0 || n == 0) return;
+    if (beta != 1.0) {
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                C[i * ldc + j] = (beta == 0.0) ? 0.0 : beta * C[i * ldc + j];
+    }
+    if (k == 0 || alpha == 0.0) return;
+    if (!pb) {
+        // без буфера — тот же порядок операций, но с шагами по памяти
+        for (size_t i = 0; i < m; ++i)
+            for (size_t p = 0; p < k; ++p) {
+                double a = alpha * (ta ? A[p * lda + i] : A[i * lda + p]);
+                for (size_t j = 0; j < n; ++j)
+                    C[i * ldc + j] += a * (tb ? B[j * ldb + p] : B[p * ldb + j]);
+            }
+        return;
+    }
+    for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+        size_t nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+        for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+            size_t kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            for (size_t p = 0; p < kc; ++p)
+                for (size_t j = 0; j < nc; ++j)
+                    pb[p * nc + j] = tb ? B[(jc + j) * ldb + pc + p] : B[(pc + p) * ldb + jc + j];
+            GemmCtx ctx = { ta, alpha, A, lda, pb, C, ldc, m, jc, nc, pc, kc };
+            size_t blocks = (m + GEMM_MC - 1) / GEMM_MC;
+            // блоки строк C независимы: параллельно, если работы хватает
+            if (m * nc * kc >= GEMM_PAR_MIN) parallel_for_owned(blocks, 1, gemm_row_blocks, &ctx);
+            else gemm_row_blocks(0, blocks, &ctx);
+        }
+    }
+}
+
+void matrix_gemm(int ta, int tb, size_t m, size_t n, size_t k,
+                 double alpha, const double *A, size_t lda,
+                 const double *B, size_t ldb,
+                 double beta, double *C, size_t ldc) {
+    // при малых m и n упаковка дороже самого умножения — тогда без буфера
+    int tiny = m <= SMALL_N_MAX && n <= SMALL_N_MAX;
+    double *pb = tiny || m == 0 || n == 0 || k == 0 ? NULL : malloc(gemm_pack_len(n, k) * sizeof(double));
+    gemm_packed(ta, tb, m, n, k, alpha, A, lda, B, ldb, beta, C, ldc, pb);
+    free(pb);
+}
+
+/* Умножение */
+Matrix *matrix_multiply(const Matrix *a, const Matrix *b) {
+    if (!a || !b) return NULL;
+    if (a->cols != b->rows) return NULL;
+    Matrix *c = matrix_create(a->rows, b->cols);
+    if (!c) return NULL;
+    size_t n = a->rows;
+    if (n <= SMALL_N_MAX && n == a->cols && n == b->cols && n > 0) {
+        small_kernels[n].mul(a->data, b->data, c->data);
+        return c;
+    }
+    matrix_gemm(0, 0, a->rows, b->cols, a->cols, 1.0, a->data, a->cols,
+                 b->data, b->cols, 0.0, c->data, c->cols);
+    return c;
+}
+
+/* Транспонирование блоками 32x32: и чтение, и запись остаются в кэше.
+   Полосы по TRANSPOSE_BLOCK строк обрабатываются в пуле. */
+#define TRANSPOSE_BLOCK 32
+
+typedef struct {
+    const double *a;
+    double *t;
+    size_t r, c;
+} TransposeCtx;
+
+static void transpose_tiles(size_t lo, size_t hi, void *arg) {
+    const TransposeCtx *x = arg;
+    for (size_t ib = lo * TRANSPOSE_BLOCK; ib < hi * TRANSPOSE_BLOCK && ib < x->r; ib += TRANSPOSE_BLOCK)
+        for (size_t jb = 0; jb < x->c; jb += TRANSPOSE_BLOCK) {
+            size_t ie = ib + TRANSPOSE_BLOCK < x->r ? ib + TRANSPOSE_BLOCK : x->r;
+            size_t je = jb + TRANSPOSE_BLOCK < x->c ? jb + TRANSPOSE_BLOCK : x->c;
+            for (size_t i = ib; i < ie; ++i)
+                for (size_t j = jb; j < je; ++j)
+                    x->t[j * x->r + i] = x->a[i * x->c + j];
+        }
+}
+
+/* Транспонирование */
+Matrix *matrix_transpose(const Matrix *a) {
+    Matrix *t = matrix_create(a->cols, a->rows);
+    if (!t) return NULL;
+    if (a->rows == a->cols && a->rows <= SMALL_N_MAX && a->rows > 0) {
+        small_kernels[a->rows].transpose(a->data, t->data);
+        return t;
+    }
+    TransposeCtx ctx = { a->data, t->data, a->rows, a->cols };
+    size_t tiles = (a->rows + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+    size_t grain = 1 + ELEM_GRAIN / (TRANSPOSE_BLOCK * (a->cols ? a->cols : 1));
+    parallel_for(tiles, grain, transpose_tiles, &ctx);
+    return t;
+}
+
+/* Симметричное обновление ранга k (SYRK), только нижний треугольник:
+   C = alpha * op(A) * op(A)^T + beta * C, op(A) = A (trans = 0, A n x k)
+   или A^T (trans = 1, A k x n). Наддиагональная часть C не трогается.
+   Блочная строка I считает блоки слева от диагонали обычным matrix_gemm,
+   а диагональный блок — тем же циклом по k над упакованной панелью, но
+   только до диагонали. Порядок суммирования как в matrix_gemm, поэтому
+   нижний треугольник совпадает с полным произведением бит в бит при
+   вдвое меньшем числе операций и без транспонированной копии A.
+   Строки-блоки I и nb-1-I идут парой: у пар одинаковый объём работы.
+*/
+#define SYRK_NB GEMM_MC
+
+typedef struct {
+    int trans;
+    size_t n, k, blocks;
+    double alpha;
+    const double *A;
+    size_t lda;
+    double *C;
+    size_t ldc;
+} SyrkCtx;
+
+// элемент op(A)[i0 + j][q]
+static inline double syrk_at(const SyrkCtx *s, const double *ai, size_t q, size_t j) {
+    return s->trans ? ai[q * s->lda + j] : ai[j * s->lda + q];
+}
+
+static void syrk_block_row(const SyrkCtx *s, size_t b, double *pb) {
+    size_t i0 = b * SYRK_NB, rb = (s->n - i0 < SYRK_NB) ? s->n - i0 : SYRK_NB;
+    const double *ai = s->trans ? s->A + i0 : s->A + i0 * s->lda;
+    if (i0 > 0)
+        matrix_gemm(s->trans, !s->trans, rb, i0, s->k, s->alpha, ai, s->lda,
+                    s->A, s->lda, 1.0, s->C + i0 * s->ldc, s->ldc);
+    if (!pb) {
+        // без буфера — тот же порядок операций, но с шагами по памяти
+        for (size_t i = 0; i < rb; ++i) {
+            double *c = s->C + (i0 + i) * s->ldc + i0;
+            for (size_t q = 0; q < s->k; ++q) {
+                double a = s->alpha * syrk_at(s, ai, q, i);
+                for (size_t j = 0; j <= i; ++j) c[j] += a * syrk_at(s, ai, q, j);
+            }
+        }
+        return;
+    }
+    for (size_t pc = 0; pc < s->k; pc += GEMM_KC) {
+        size_t kc = (s->k - pc < GEMM_KC) ? s->k - pc : GEMM_KC;
+        for (size_t p = 0; p < kc; ++p)
+            for (size_t j = 0; j < rb; ++j) pb[p * rb + j] = syrk_at(s, ai, pc + p, j);
+        for (size_t i = 0; i < rb; ++i) {
+            double *c = s->C + (i0 + i) * s->ldc + i0;
+            for (size_t p = 0; p < kc; ++p) {
+                double a = s->alpha * pb[p * rb + i];
+                const double *bp = pb + p * rb;
+                for (size_t j = 0; j <= i; ++j) c[j] += a * bp[j];
+            }
+        }
+    }
+}
+
+static void syrk_pairs(size_t lo, size_t hi, void *arg) {
+    const SyrkCtx *s = arg;
+    double *pb = malloc(GEMM_KC * SYRK_NB * sizeof(double));
+    for (size_t t = lo; t < hi; ++t) {
+        syrk_block_row(s, t, pb);
+        if (s->blocks - 1 - t != t) syrk_block_row(s, s->blocks - 1 - t, pb);
+    }
+    free(pb);
+}
+
+void matrix_syrk(int trans, size_t n, size_t k, double alpha,
+                 const double *A, size_t lda, double beta, double *C, size_t ldc) {
+    if (n == 0) return;
+    if (beta != 1.0) {
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j <= i; ++j)
+                C[i * ldc + j] = (beta == 0.0) ? 0.0 : beta * C[i * ldc + j];
+    }
+    if (k == 0 || alpha == 0.0) return;
+    SyrkCtx ctx = { trans, n, k, (n + SYRK_NB - 1) / SYRK_NB, alpha, A, lda, C, ldc };
+    size_t pairs = (ctx.blocks + 1) / 2;
+    if (n * n / 2 * k >= GEMM_PAR_MIN) parallel_for(pairs, 1, syrk_pairs, &ctx);
+    else syrk_pairs(0, pairs, &ctx);
+}
+
+/* Копирование нижнего треугольника наверх плитками TRANSPOSE_BLOCK */
+static void mirror_lower(double *c, size_t n, size_t ldc) {
+    for (size_t ib = 0; ib < n; ib += TRANSPOSE_BLOCK)
+        for (size_t jb = 0; jb <= ib; jb += TRANSPOSE_BLOCK) {
+            size_t ie = ib + TRANSPOSE_BLOCK < n ? ib + TRANSPOSE_BLOCK : n;
+            size_t je = jb + TRANSPOSE_BLOCK < n ? jb + TRANSPOSE_BLOCK : n;
+            for (size_t i = ib; i < ie; ++i)
+                for (size_t j = jb; j < je && j < i; ++j) c[j * ldc + i] = c[i * ldc + j];
+        }
+}
+
+static Matrix *gram(const Matrix *a, int trans) {
+    if (!a) return NULL;
+    size_t n = trans ? a->cols : a->rows, k = trans ? a->rows : a->cols;
+    Matrix *c = matrix_create(n, n);
+    if (!c) return NULL;
+    matrix_syrk(trans, n, k, 1.0, a->data, a->cols, 0.0, c->data, n);
+    mirror_lower(c->data, n, n);
+    return c;
+}
+
+/* A^T A (cols x cols) и A A^T (rows x rows) без транспонирования A */
+Matrix *matrix_ata(const Matrix *a) { return gram(a, 1); }
+Matrix *matrix_aat(const Matrix *a) { return gram(a, 0); }
+
+/* Сохранение/загрузка в простой текстовый формат:
+   Первая строка: rows cols
+   Далее rows строк по cols чисел.
+*/
+int matrix_save_txt(const Matrix *m, const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) return 0;
+    fprintf(f, "%zu %zu\n", m->rows, m->cols);
+    for (size_t i = 0; i < m->rows; ++i) {
+        for (size_t j = 0; j < m->cols; ++j) {
+            fprintf(f, "%.12g ", matrix_get(m, i, j));
+        }
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return 1;
+}
+
+/* Разбор чисел текстового формата: остаток файла читается в память,
+   делится на куски по границам пробелов; первый проход считает числа в
+   кусках, второй разбирает их сразу на свои места (strtod / strtof).
+   Куски обрабатываются в пуле. Числа сверх count не проверяются.
+*/
+#define TXT_GRAIN 65536 // байт на кусок
+
+typedef struct {
+    const char *buf;
+    size_t len, chunks, count;
+    size_t *bounds; // chunks + 1 границ
+    size_t *first;  // номер первого числа куска
+    int *bad;
+    void *dst;
+    int single;     // 1 — float, 0 — double
+} TxtParse;
+
+static int txt_space(char ch) {
+    return ch == ' ' || ch == '\n' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+}
+
+static void txt_count_range(size_t lo, size_t hi, void *arg) {
+    TxtParse *t = arg;
+    for (size_t c = lo; c < hi; ++c) {
+        size_t n = 0;
+        for (size_t i = t->bounds[c]; i < t->bounds[c + 1]; ++i)
+            if (!txt_space(t->buf[i]) && (i == 0 || txt_space(t->buf[i - 1]))) ++n;
+        t->first[c + 1] = n;
+    }
+}
+
+static void txt_parse_range(size_t lo, size_t hi, void *arg) {
+    TxtParse *t = arg;
+    for (size_t c = lo; c < hi; ++c) {
+        size_t k = t->first[c], i = t->bounds[c], end = t->bounds[c + 1];
+        while (i < end && k < t->count) {
+            while (i < end && txt_space(t->buf[i])) ++i;
+            if (i == end) break;
+            size_t e = i;
+            while (e < t->len && !txt_space(t->buf[e])) ++e;
+            char *stop;
+            if (t->single) ((float *)t->dst)[k] = strtof(t->buf + i, &stop);
+            else ((double *)t->dst)[k] = strtod(t->buf + i, &stop);
+            if (stop != t->buf + e) { t->bad[c] = 1; return; }
+            ++k;
+            i = e;
+        }
+    }
+}
+
+/* Читает count чисел из остатка файла в dst; 0 — ошибка формата или памяти */
+static int txt_parse_numbers(FILE *f, void *dst, size_t count, int single) {
+    size_t cap = 1 << 16, len = 0;
+    char *buf = malloc(cap);
+    if (!buf) return 0;
+    for (;;) {
+        if (cap - len < 2) {
+            char *nb = realloc(buf, cap * 2);
+            if (!nb) { free(buf); return 0; }
+            buf = nb;
+            cap *= 2;
+        }
+        size_t got = fread(buf + len, 1, cap - len - 1, f);
+        if (got == 0) break;
+        len += got;
+    }
+    buf[len] = '\0';
+    TxtParse t = { buf, len, (len + TXT_GRAIN - 1) / TXT_GRAIN, count, NULL, NULL, NULL, dst, single };
+    if (t.chunks == 0) t.chunks = 1;
+    t.bounds = malloc((t.chunks + 1) * sizeof(size_t));
+    t.first = calloc(t.chunks + 1, sizeof(size_t));
+    t.bad = calloc(t.chunks, sizeof(int));
+    int ok = t.bounds && t.first && t.bad;
+    if (ok) {
+        // граница сдвигается до пробела, чтобы не резать число
+        for (size_t c = 0; c <= t.chunks; ++c) {
+            size_t b = len * c / t.chunks;
+            if (c > 0 && b < t.bounds[c - 1]) b = t.bounds[c - 1];
+            while (b < len && c > 0 && c < t.chunks && !txt_space(buf[b])) ++b;
+            t.bounds[c] = b;
+        }
+        parallel_for(t.chunks, 1, txt_count_range, &t);
+        for (size_t c = 0; c < t.chunks; ++c) t.first[c + 1] += t.first[c];
+        ok = t.first[t.chunks] >= count;
+    }
+    if (ok) {
+        parallel_for(t.chunks, 1, txt_parse_range, &t);
+        for (size_t c = 0; c < t.chunks; ++c)
+            if (t.bad[c]) ok = 0;
+    }
+    free(t.bounds); free(t.first); free(t.bad); free(buf);
+    return ok;
+}
+
+Matrix *matrix_load_txt(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) return NULL;
+    size_t rows, cols;
+    if (fscanf(f, "%zu %zu", &rows, &cols) != 2) { fclose(f); return NULL; }
+    Matrix *m = matrix_create(rows, cols);
+    if (!m) { fclose(f); return NULL; }
+    if (!txt_parse_numbers(f, m->data, rows * cols, 0)) {
+        matrix_free(m);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    return m;
+}
+
+/* ====== Матрицы float32 ====== */
+
+/* Та же построчная раскладка, что у Matrix, но элементы float:
+   вдвое меньше памяти и трафика, вдвое больше элементов в SIMD-регистре.
+   Точность ~7 знаков — для данных, которые и так хранятся во float.
+*/
+typedef struct {
+    size_t rows;
+    size_t cols;
+    float *data; // contiguous storage: data[i*cols + j]
+} MatrixF;
+
+/* Векторный тип для SIMD-ядер (GCC/Clang vector extensions); компилятор
+   раскладывает 8 float на доступные регистры: 2 x SSE, 1 x AVX.
+   aligned(4) — допускаются невыровненные адреса.
+*/
+#if defined(__GNUC__)
+#define MATRIXF_SIMD 1
+#define VF_WIDTH 8
+typedef float vf8 __attribute__((vector_size(32), aligned(4), __may_alias__));
+#endif
+
+MatrixF *matrixf_create(size_t rows, size_t cols) {
+    MatrixF *m = malloc(sizeof(MatrixF));
+    if (!m) return NULL;
+    m->rows = rows;
+    m->cols = cols;
+    m->data = matrix_alloc(rows, cols * sizeof(float), 1);
+    if (!m->data) { free(m); return NULL; }
+    return m;
+}
+
+void matrixf_free(MatrixF *m) {
+    if (!m) return;
+    free(m->data);
+    free(m);
+}
+
+/* Преобразования double <-> float (значения вне диапазона float станут +-inf) */
+MatrixF *matrix_to_float(const Matrix *a) {
+    if (!a) return NULL;
+    MatrixF *f = matrixf_create(a->rows, a->cols);
+    if (!f) return NULL;
+    for (size_t i = 0; i < a->rows * a->cols; ++i) f->data[i] = (float)a->data[i];
+    return f;
+}
+
+Matrix *matrixf_to_double(const MatrixF *a) {
+    if (!a) return NULL;
+    Matrix *d = matrix_create(a->rows, a->cols);
+    if (!d) return NULL;
+    for (size_t i = 0; i < a->rows * a->cols; ++i) d->data[i] = a->data[i];
+    return d;
+}
+
+/* c[i] = a[i] + s * b[i], s = +-1 */
+static void saxpy_kernel(size_t len, const float *a, float s, const float *b, float *c) {
+    size_t i = 0;
+#ifdef MATRIXF_SIMD
+    for (; i + VF_WIDTH <= len; i += VF_WIDTH)
+        *(vf8 *)(c + i) = *(const vf8 *)(a + i) + s * *(const vf8 *)(b + i);
+#endif
+    for (; i < len; ++i) c[i] = a[i] + s * b[i];
+}
+
+MatrixF *matrixf_add_sub(const MatrixF *a, const MatrixF *b, int subtract) {
+    if (!a || !b) return NULL;
+    if (a->rows != b->rows || a->cols != b->cols) return NULL;
+    MatrixF *c = matrixf_create(a->rows, a->cols);
+    if (!c) return NULL;
+    saxpy_kernel(a->rows * a->cols, a->data, subtract ? -1.0f : 1.0f, b->data, c->data);
+    return c;
+}
+
+/* Ядро умножения float: C = alpha * op(A) * op(B) + beta * C.
+   Те же блоки и тот же порядок суммирования по k, что у matrix_gemm;
+   внутренний цикл по строке C идёт векторами по VF_WIDTH элементов.
+*/
+void matrixf_gemm(int ta, int tb, size_t m, size_t n, size_t k,
+                  float alpha, const float *A, size_t lda,
+                  const float *B, size_t ldb,
+                  float beta, float *C, size_t ldc) {
+    if (m == 0 || n == 0) return;
+    if (beta != 1.0f) {
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                C[i * ldc + j] = (beta == 0.0f) ? 0.0f : beta * C[i * ldc + j];
+    }
+    if (k == 0 || alpha == 0.0f) return;
+    size_t nb = n < GEMM_NC ? n : GEMM_NC;
+    size_t kb = k < GEMM_KC ? k : GEMM_KC;
+    float *pb = malloc(kb * nb * sizeof(float));
+    if (!pb) {
+        for (size_t i = 0; i < m; ++i)
+            for (size_t p = 0; p < k; ++p) {
+                float a = alpha * (ta ? A[p * lda + i] : A[i * lda + p]);
+                for (size_t j = 0; j < n; ++j)
+                    C[i * ldc + j] += a * (tb ? B[j * ldb + p] : B[p * ldb + j]);
+            }
+        return;
+    }
+    for (size_t jc = 0; jc < n; jc += GEMM_NC) {
+        size_t nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+        for (size_t pc = 0; pc < k; pc += GEMM_KC) {
+            size_t kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            for (size_t p = 0; p < kc; ++p)
+                for (size_t j = 0; j < nc; ++j)
+                    pb[p * nc + j] = tb ? B[(jc + j) * ldb + pc + p] : B[(pc + p) * ldb + jc + j];
+            for (size_t ic = 0; ic < m; ic += GEMM_MC) {
+                size_t mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                for (size_t i = ic; i < ic + mc; ++i) {
+                    float *c = C + i * ldc + jc;
+                    for (size_t p = 0; p < kc; ++p) {
+                        float a = alpha * (ta ? A[(pc + p) * lda + i] : A[i * lda + pc + p]);
+                        const float *b = pb + p * nc;
+                        size_t j = 0;
+#ifdef MATRIXF_SIMD
+                        for (; j + VF_WIDTH <= nc; j += VF_WIDTH)
+                            *(vf8 *)(c + j) += a * *(const vf8 *)(b + j);
+#endif
+                        for (; j < nc; ++j) c[j] += a * b[j];
+                    }
+                }
+            }
+        }
+    }
+    free(pb);
+}
+
+MatrixF *matrixf_multiply(const MatrixF *a, const MatrixF *b) {
+    if (!a || !b) return NULL;
+    if (a->cols != b->rows) return NULL;
+    MatrixF *c = matrixf_create(a->rows, b->cols);
+    if (!c) return NULL;
+    matrixf_gemm(0, 0, a->rows, b->cols, a->cols, 1.0f, a->data, a->cols,
+                 b->data, b->cols, 0.0f, c->data, c->cols);
+    return c;
+}
+
+/* Транспонирование блоками TRANSPOSE_BLOCK, как matrix_transpose */
+MatrixF *matrixf_transpose(const MatrixF *a) {
+    if (!a) return NULL;
+    MatrixF *t = matrixf_create(a->cols, a->rows);
+    if (!t) return NULL;
+    size_t r = a->rows, c = a->cols;
+    for (size_t ib = 0; ib < r; ib += TRANSPOSE_BLOCK)
+        for (size_t jb = 0; jb < c; jb += TRANSPOSE_BLOCK) {
+            size_t ie = ib + TRANSPOSE_BLOCK < r ? ib + TRANSPOSE_BLOCK : r;
+            size_t je = jb + TRANSPOSE_BLOCK < c ? jb + TRANSPOSE_BLOCK : c;
+            for (size_t i = ib; i < ie; ++i)
+                for (size_t j = jb; j < je; ++j)
+                    t->data[j * r + i] = a->data[i * c + j];
+        }
+    return t;
+}
+
+/* Текстовый формат тот же, что у matrix_save_txt / matrix_load_txt */
+int matrixf_save_txt(const MatrixF *m, const char *filename) {
+    FILE *f = fopen(filename, "w");
+    if (!f) return 0;
+    fprintf(f, "%zu %zu\n", m->rows, m->cols);
+    for (size_t i = 0; i < m->rows; ++i) {
+        for (size_t j = 0; j < m->cols; ++j)
+            fprintf(f, "%.9g ", m->data[i * m->cols + j]);
+        fprintf(f, "\n");
+    }
+    fclose(f);
+    return 1;
+}
+
+MatrixF *matrixf_load_txt(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) return NULL;
+    size_t rows, cols;
+    if (fscanf(f, "%zu %zu", &rows, &cols) != 2) { fclose(f); return NULL; }
+    MatrixF *m = matrixf_create(rows, cols);
+    if (!m) { fclose(f); return NULL; }
+    if (!txt_parse_numbers(f, m->data, rows * cols, 1)) {
+        matrixf_free(m);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    return m;
+}
+
+/* ====== Бинарный формат ====== */
+
+/* Заголовок 24 байта, затем rows*cols элементов построчно:
+     char     magic[4] = "CMTX"
+     uint8_t  version  = 1
+     uint8_t  dtype    (MatrixDType)
+     uint16_t bom      = 0x0102 (порядок байт записавшей машины)
+     uint64_t rows, cols
+   Числа пишутся в порядке байт машины; файл с чужим порядком
+   (bom прочитан как 0x0201) отвергается.
+*/
+typedef enum {
+    MATRIX_F64 = 0,
+    MATRIX_F32 = 1
+} MatrixDType;
+
+#define MATRIX_BIN_MAGIC "CMTX"
+#define MATRIX_BIN_VERSION 1
+#define MATRIX_BIN_BOM 0x0102
+#define MATRIX_BIN_CHUNK 4096
+
+static size_t dtype_size(MatrixDType dtype) {
+    return dtype == MATRIX_F32 ? sizeof(float) : sizeof(double);
+}
+
+static int bin_write_header(FILE *f, MatrixDType dtype, size_t rows, size_t cols) {
+    unsigned char hdr[8] = {'C', 'M', 'T', 'X', MATRIX_BIN_VERSION, (unsigned char)dtype, 0, 0};
+    uint16_t bom = MATRIX_BIN_BOM;
+    memcpy(hdr + 6, &bom, sizeof(bom));
+    uint64_t dims[2] = {rows, cols};
+    return fwrite(hdr, 1, sizeof(hdr), f) == sizeof(hdr) && fwrite(dims, sizeof(uint64_t), 2, f) == 2;
+}
+
+/* Читает заголовок; 0 — не наш формат, другой порядок байт или неизвестный dtype */
+static int bin_read_header(FILE *f, MatrixDType *dtype, size_t *rows, size_t *cols) {
+    unsigned char hdr[8];
+    uint64_t dims[2];
+    uint16_t bom;
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) return 0;
+    if (memcmp(hdr, MATRIX_BIN_MAGIC, 4) != 0 || hdr[4] != MATRIX_BIN_VERSION) return 0;
+    memcpy(&bom, hdr + 6, sizeof(bom));
+    if (bom != MATRIX_BIN_BOM) return 0;
+    if (hdr[5] != MATRIX_F64 && hdr[5] != MATRIX_F32) return 0;
+    if (fread(dims, sizeof(uint64_t), 2, f) != 2) return 0;
+    if (dims[0] > SIZE_MAX || dims[1] > SIZE_MAX) return 0;
+    if (dims[1] && dims[0] > SIZE_MAX / dims[1] / sizeof(double)) return 0;
+    *dtype = (MatrixDType)hdr[5];
+    *rows = (size_t)dims[0];
+    *cols = (size_t)dims[1];
+    return 1;
+}
+
+/* Запись count элементов src (src_dtype) в файл как dst_dtype;
+   при совпадении типов — одним fwrite, иначе через буфер
+*/
+static int bin_write_data(FILE *f, const void *src, MatrixDType src_dtype, size_t count, MatrixDType dst_dtype) {
+    if (src_dtype == dst_dtype)
+        return fwrite(src, dtype_size(dst_dtype), count, f) == count;
+    union { double d[MATRIX_BIN_CHUNK]; float s[MATRIX_BIN_CHUNK]; } buf;
+    for (size_t off = 0; off < count; off += MATRIX_BIN_CHUNK) {
+        size_t len = count - off < MATRIX_BIN_CHUNK ? count - off : MATRIX_BIN_CHUNK;
+        if (dst_dtype == MATRIX_F32)
+            for (size_t i = 0; i < len; ++i) buf.s[i] = (float)((const double *)src)[off + i];
+        else
+            for (size_t i = 0; i < len; ++i) buf.d[i] = ((const float *)src)[off + i];
+        if (fwrite(&buf, dtype_size(dst_dtype), len, f) != len) return 0;
+    }
+    return 1;
+}
+
+static int bin_read_data(FILE *f, MatrixDType src_dtype, size_t count, void *dst, MatrixDType dst_dtype) {
+    if (src_dtype == dst_dtype)
+        return fread(dst, dtype_size(dst_dtype), count, f) == count;
+    union { double d[MATRIX_BIN_CHUNK]; float s[MATRIX_BIN_CHUNK]; } buf;
+    for (size_t off = 0; off < count; off += MATRIX_BIN_CHUNK) {
+        size_t len = count - off < MATRIX_BIN_CHUNK ? count - off : MATRIX_BIN_CHUNK;
+        if (fread(&buf, dtype_size(src_dtype), len, f) != len) return 0;
+        if (dst_dtype == MATRIX_F32)
+            for (size_t i = 0; i < len; ++i) ((float *)dst)[off + i] = (float)buf.d[i];
+        else
+            for (size_t i = 0; i < len; ++i) ((double *)dst)[off + i] = buf.s[i];
+    }
+    return 1;
+}
+
+/* Сохранение double-матрицы с выбранным типом элементов в файле */
+int matrix_save_bin(const Matrix *m, const char *filename, MatrixDType dtype) {
+    if (!m || (dtype != MATRIX_F64 && dtype != MATRIX_F32)) return 0;
+    FILE *f = fopen(filename, "wb");
+    if (!f) return 0;
+    int ok = bin_write_header(f, dtype, m->rows, m->cols)
+          && bin_write_data(f, m->data, MATRIX_F64, m->rows * m->cols, dtype);
+    if (fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+int matrixf_save_bin(const MatrixF *m, const char *filename, MatrixDType dtype) {
+    if (!m || (dtype != MATRIX_F64 && dtype != MATRIX_F32)) return 0;
+    FILE *f = fopen(filename, "wb");
+    if (!f) return 0;
+    int ok = bin_write_header(f, dtype, m->rows, m->cols)
+          && bin_write_data(f, m->data, MATRIX_F32, m->rows * m->cols, dtype);
+    if (fclose(f) != 0) ok = 0;
+    return ok;
+}
+
+/* 1, если файл начинается с сигнатуры "CMTX" (бинарный формат, пусть и
+   повреждённый) — такой файл нельзя читать как текст */
+int matrix_file_is_bin(const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return 0;
+    char magic[4];
+    int bin = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, MATRIX_BIN_MAGIC, 4) == 0;
+    fclose(f);
+    return bin;
+}
+
+/* Загрузка файла любого dtype в double-матрицу; в *dtype (если не NULL) —
+   тип элементов в файле. NULL, если файл не в бинарном формате, обрезан
+   или повреждён.
+*/
+Matrix *matrix_load_bin(const char *filename, MatrixDType *dtype) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+    MatrixDType dt;
+    size_t rows, cols;
+    Matrix *m = NULL;
+    if (bin_read_header(f, &dt, &rows, &cols) && (m = matrix_create(rows, cols)) != NULL
+        && !bin_read_data(f, dt, rows * cols, m->data, MATRIX_F64)) {
+        matrix_free(m);
+        m = NULL;
+    }
+    fclose(f);
+    if (m && dtype) *dtype = dt;
+    return m;
+}
+
+MatrixF *matrixf_load_bin(const char *filename, MatrixDType *dtype) {
+    FILE *f = fopen(filename, "rb");
+    if (!f) return NULL;
+    MatrixDType dt;
+    size_t rows, cols;
+    MatrixF *m = NULL;
+    if (bin_read_header(f, &dt, &rows, &cols) && (m = matrixf_create(rows, cols)) != NULL
+        && !bin_read_data(f, dt, rows * cols, m->data, MATRIX_F32)) {
+        matrixf_free(m);
+        m = NULL;
+    }
+    fclose(f);
+    if (m && dtype) *dtype = dt;
+    return m;
+}
+
+/* ====== Квантованное умножение (int8 / int16) ====== */
+
+/* Симметричное квантование: A — по строкам, B — по столбцам,
+   a_ik ~ sa_i * qa_ik, b_kj ~ sb_j * qb_kj, |q| <= 127 (int8) или 32767 (int16).
+   Тогда C_ij ~ sa_i * sb_j * sum_k qa_ik * qb_kj, и сумма считается точно
+   в целых. B хранится транспонированной, так что ядро — скалярные
+   произведения двух непрерывных строк.
+   int8: произведения (|p| <= 16129) складываются в int32 по 16 полос,
+   каждые QGEMM_FLUSH шагов полосы сбрасываются в int64 — переполнения нет.
+   int16: произведение достигает 2^30, два таких уже переполняют int32,
+   поэтому полосы сразу int64.
+*/
+#define QGEMM_NB 64
+#define QGEMM_FLUSH 8192
+
+#if defined(MATRIXF_SIMD) && (defined(__clang__) || __GNUC__ >= 9)
+#define QGEMM_SIMD 1
+#define QV_WIDTH 16
+typedef int8_t  qv8   __attribute__((vector_size(16), aligned(1), __may_alias__));
+typedef int16_t qv16  __attribute__((vector_size(32), aligned(2), __may_alias__));
+typedef int16_t qv16x8 __attribute__((vector_size(16), aligned(2), __may_alias__));
+typedef int32_t qv32  __attribute__((vector_size(64)));
+typedef int32_t qv32x8 __attribute__((vector_size(32)));
+typedef int64_t qv64x8 __attribute__((vector_size(64)));
+#endif
+
+static int64_t qdot8(const int8_t *a, const int8_t *b, size_t k) {
+    int64_t sum = 0;
+    size_t p = 0;
+#ifdef QGEMM_SIMD
+    while (p + QV_WIDTH <= k) {
+        qv32 acc = {0};
+        size_t end = p + (size_t)QGEMM_FLUSH * QV_WIDTH;
+        if (end > k) end = k;
+        for (; p + QV_WIDTH <= end; p += QV_WIDTH) {
+            qv16 prod = __builtin_convertvector(*(const qv8 *)(a + p), qv16)
+                      * __builtin_convertvector(*(const qv8 *)(b + p), qv16);
+            acc += __builtin_convertvector(prod, qv32);
+        }
+        for (int l = 0; l < QV_WIDTH; ++l) sum += acc[l];
+    }
+#endif
+    for (; p < k; ++p) sum += (int32_t)a[p] * b[p];
+    return sum;
+}
+
+static int64_t qdot16(const int16_t *a, const int16_t *b, size_t k) {
+    int64_t sum = 0;
+    size_t p = 0;
+#ifdef QGEMM_SIMD
+    qv64x8 acc = {0};
+    for (; p + 8 <= k; p += 8) {
+        qv32x8 prod = __builtin_convertvector(*(const qv16x8 *)(a + p), qv32x8)
+                    * __builtin_convertvector(*(const qv16x8 *)(b + p), qv32x8);
+        acc += __builtin_convertvector(prod, qv64x8);
+    }
+    for (int l = 0; l < 8; ++l) sum += acc[l];
+#endif
+    for (; p < k; ++p) sum += (int32_t)a[p] * b[p];
+    return sum;
+}
+
+/* Квантует rows векторов длины len (элемент (v, t) по адресу x[v*sv + t*st])
+   в q[v*len + t], масштаб — в scale[v] */
+static void quantize_vectors(const double *x, size_t rows, size_t len, size_t sv, size_t st,
+                             int bits, void *q, double *scale) {
+    double qmax = bits == 8 ? 127.0 : 32767.0;
+    for (size_t v = 0; v < rows; ++v) {
+        double amax = 0.0;
+        for (size_t t = 0; t < len; ++t) {
+            double y = fabs(x[v * sv + t * st]);
+            if (y > amax) amax = y;
+        }
+        double s = amax / qmax, inv = amax > 0.0 ? qmax / amax : 0.0;
+        scale[v] = s;
+        for (size_t t = 0; t < len; ++t) {
+            long r = lrint(x[v * sv + t * st] * inv);
+            if (bits == 8) ((int8_t *)q)[v * len + t] = (int8_t)r;
+            else ((int16_t *)q)[v * len + t] = (int16_t)r;
+        }
+    }
+}
+
+typedef struct {
+    const void *qa, *qbt;
+    const double *sa, *sb;
+    size_t n, k;
+    int bits;
+    double *c;
+} QGemmCtx;
+
+static void qgemm_rows(size_t lo, size_t hi, void *arg) {
+    const QGemmCtx *g = arg;
+    size_t n = g->n, k = g->k;
+    for (size_t jb = 0; jb < n; jb += QGEMM_NB) {
+        size_t je = jb + QGEMM_NB < n ? jb + QGEMM_NB : n;
+        for (size_t i = lo; i < hi; ++i)
+            for (size_t j = jb; j < je; ++j) {
+                int64_t dot = g->bits == 8
+                    ? qdot8((const int8_t *)g->qa + i * k, (const int8_t *)g->qbt + j * k, k)
+                    : qdot16((const int16_t *)g->qa + i * k, (const int16_t *)g->qbt + j * k, k);
+                g->c[i * n + j] = g->sa[i] * g->sb[j] * (double)dot;
+            }
+    }
+}
+
+/* Приближённое C = A * B через квантование до bits = 8 или 16 бит.
+   Если rel_err != NULL, дополнительно считается точное matrix_multiply и
+   возвращается max|C - C_q| / max|C| (0, если C = 0). NULL при
+   несовместимых размерах, неверном bits или нехватке памяти.
+*/
+Matrix *matrix_multiply_quantized(const Matrix *a, const Matrix *b, int bits, double *rel_err) {
+    if (!a || !b || a->cols != b->rows || (bits != 8 && bits != 16)) return NULL;
+    size_t m = a->rows, k = a->cols, n = b->cols;
+    size_t esz = bits == 8 ? sizeof(int8_t) : sizeof(int16_t);
+    size_t mk = m * k, nk = n * k;
+    void *qa = malloc((mk ? mk : 1) * esz);
+    void *qbt = malloc((nk ? nk : 1) * esz);
+    double *sa = malloc((m ? m : 1) * sizeof(double));
+    double *sb = malloc((n ? n : 1) * sizeof(double));
+    Matrix *c = matrix_create(m, n);
+    if (!qa || !qbt || !sa || !sb || !c) {
+        free(qa); free(qbt); free(sa); free(sb); matrix_free(c);
+        return NULL;
+    }
+    quantize_vectors(a->data, m, k, k, 1, bits, qa, sa);
+    quantize_vectors(b->data, n, k, 1, n, bits, qbt, sb);
+    QGemmCtx ctx = {qa, qbt, sa, sb, n, k, bits, c->data};
+    size_t grain = nk ? (1u << 20) / nk + 1 : m;
+    parallel_for(m, grain, qgemm_rows, &ctx);
+    free(qa); free(qbt); free(sa); free(sb);
+    if (rel_err) {
+        *rel_err = -1.0;
+        Matrix *exact = matrix_multiply(a, b);
+        if (exact) {
+            double emax = 0.0, cmax = 0.0;
+            for (size_t i = 0; i < m * n; ++i) {
+                double d = fabs(exact->data[i] - c->data[i]);
+                if (d > emax) emax = d;
+                if (fabs(exact->data[i]) > cmax) cmax = fabs(exact->data[i]);
+            }
+            *rel_err = cmax > 0.0 ? emax / cmax : 0.0;
+            matrix_free(exact);
+        }
+    }
+    return c;
+}
+
+/* ====== Комплексные матрицы ====== */
+
+/* Раздельное (planar) хранение: re и im — две построчные матрицы rows x cols.
+   Так комплексное умножение сводится к вещественным matrix_gemm, а
+   внутренние циклы LU остаются непрерывными вещественными циклами.
+*/
+typedef struct {
+    size_t rows;
+    size_t cols;
+    double *re; // re[i*cols + j]
+    double *im; // im[i*cols + j]
+} MatrixC;
+
+MatrixC *matrixc_create(size_t rows, size_t cols) {
+    MatrixC *m = malloc(sizeof(MatrixC));
+    if (!m) return NULL;
+    m->rows = rows;
+    m->cols = cols;
+    size_t n = rows * cols;
+    m->re = calloc(n ? n : 1, sizeof(double));
+    m->im = calloc(n ? n : 1, sizeof(double));
+    if (!m->re || !m->im) { free(m->re); free(m->im); free(m); return NULL; }
+    return m;
+}
+
+void matrixc_free(MatrixC *m) {
+    if (!m) return;
+    free(m->re);
+    free(m->im);
+    free(m);
+}
+
+/* re + i*im из двух вещественных матриц одного размера (im может быть NULL) */
+MatrixC *matrixc_from_real(const Matrix *re, const Matrix *im) {
+    if (!re || (im && (im->rows != re->rows || im->cols != re->cols))) return NULL;
+    MatrixC *m = matrixc_create(re->rows, re->cols);
+    if (!m) return NULL;
+    memcpy(m->re, re->data, re->rows * re->cols * sizeof(double));
+    if (im) memcpy(m->im, im->data, re->rows * re->cols * sizeof(double));
+    return m;
+}
+
+void matrixc_print(const MatrixC *m) {
+    if (!m) { printf("(null)\n"); return; }
+    printf("Complex matrix %zux%zu:\n", m->rows, m->cols);
+    for (size_t i = 0; i < m->rows; ++i) {
+        for (size_t j = 0; j < m->cols; ++j) {
+            double im = m->im[i * m->cols + j];
+            printf("%10.4g%+.4gi ", m->re[i * m->cols + j], im);
+        }
+        printf("\n");
+    }
+}
+
+MatrixC *matrixc_add_sub(const MatrixC *a, const MatrixC *b, int subtract) {
+    if (!a || !b) return NULL;
+    if (a->rows != b->rows || a->cols != b->cols) return NULL;
+    MatrixC *c = matrixc_create(a->rows, a->cols);
+    if (!c) return NULL;
+    double s = subtract ? -1.0 : 1.0;
+    for (size_t i = 0; i < a->rows * a->cols; ++i) {
+        c->re[i] = a->re[i] + s * b->re[i];
+        c->im[i] = a->im[i] + s * b->im[i];
+    }
+    return c;
+}
+
+/* Умножение методом 3M: три вещественных произведения вместо четырёх,
+     T1 = Ar Br,  T2 = Ai Bi,  T3 = (Ar + Ai)(Br + Bi),
+     Cr = T1 - T2,  Ci = T3 - T1 - T2.
+   ~25% меньше операций; ошибка Ci оценивается через |A||B|, а не через
+   |Ci| (как у 4M), что для большинства задач обработки сигналов приемлемо.
+*/
+MatrixC *matrixc_multiply(const MatrixC *a, const MatrixC *b) {
+    if (!a || !b) return NULL;
+    if (a->cols != b->rows) return NULL;
+    size_t m = a->rows, k = a->cols, n = b->cols;
+    size_t mk = m * k, kn = k * n;
+    MatrixC *c = matrixc_create(m, n);
+    double *sa = malloc((mk ? mk : 1) * sizeof(double));
+    double *sb = malloc((kn ? kn : 1) * sizeof(double));
+    if (!c || !sa || !sb) { matrixc_free(c); free(sa); free(sb); return NULL; }
+    for (size_t i = 0; i < mk; ++i) sa[i] = a->re[i] + a->im[i];
+    for (size_t i = 0; i < kn; ++i) sb[i] = b->re[i] + b->im[i];
+    // c->im = T3, c->re = T1; T2 считается в sa (он больше не нужен)
+    matrix_gemm(0, 0, m, n, k, 1.0, sa, k, sb, n, 0.0, c->im, n);
+    matrix_gemm(0, 0, m, n, k, 1.0, a->re, k, b->re, n, 0.0, c->re, n);
+    free(sb);
+    double *t2 = (m * n <= mk) ? sa : realloc(sa, m * n * sizeof(double));
+    if (!t2) { free(sa); matrixc_free(c); return NULL; }
+    matrix_gemm(0, 0, m, n, k, 1.0, a->im, k, b->im, n, 0.0, t2, n);
+    for (size_t i = 0; i < m * n; ++i) {
+        c->im[i] -= c->re[i] + t2[i];
+        c->re[i] -= t2[i];
+    }
+    free(t2);
+    return c;
+}
+
+/* Комплексное LU с частичным выбором по модулю: P A = L U на месте
+   (re/im раздельно, шаг строки n). Опорный элемент с |u_kk| <= tol
+   считается нулевым — возвращается 0.
+*/
+static int lu_factor_c(double *re, double *im, size_t n, size_t *piv, double tol) {
+    for (size_t i = 0; i < n; ++i) {
+        size_t p = i;
+        double best = -1.0;
+        for (size_t r = i; r < n; ++r) {
+            double v = hypot(re[r * n + i], im[r * n + i]);
+            if (v > best) { best = v; p = r; }
+        }
+        piv[i] = p;
+        if (!(best > tol)) return 0;
+        if (p != i)
+            for (size_t c = 0; c < n; ++c) {
+                double t = re[i * n + c]; re[i * n + c] = re[p * n + c]; re[p * n + c] = t;
+                t = im[i * n + c]; im[i * n + c] = im[p * n + c]; im[p * n + c] = t;
+            }
+        // 1 / pivot = conj(pivot) / |pivot|^2, через масштаб для устойчивости
+        double pr = re[i * n + i], pi = im[i * n + i];
+        double s = fabs(pr) > fabs(pi) ? fabs(pr) : fabs(pi);
+        double qr = pr / s, qi = pi / s, d = s * (qr * qr + qi * qi);
+        double ir = qr / d, ii = -qi / d;
+        const double *ur = re + i * n, *ui = im + i * n;
+        for (size_t r = i + 1; r < n; ++r) {
+            double ar = re[r * n + i], ai = im[r * n + i];
+            double fr = ar * ir - ai * ii, fi = ar * ii + ai * ir;
+            re[r * n + i] = fr;
+            im[r * n + i] = fi;
+            double *rr = re + r * n, *ri = im + r * n;
+            for (size_t c = i + 1; c < n; ++c) {
+                rr[c] -= fr * ur[c] - fi * ui[c];
+                ri[c] -= fr * ui[c] + fi * ur[c];
+            }
+        }
+    }
+    return 1;
+}
+
+static double singular_tol_c(const MatrixC *a) {
+    double amax = 0.0;
+    for (size_t i = 0; i < a->rows * a->cols; ++i) {
+        double v = hypot(a->re[i], a->im[i]);
+        if (v > amax) amax = v;
+    }
+    return (double)a->rows * DBL_EPSILON * amax;
+}
+
+/* Детерминант комплексной матрицы: произведение опорных элементов LU.
+   Произведение ведётся с отдельной двоичной экспонентой, поэтому
+   промежуточные значения не переполняются. Вырожденная матрица — 0.
+   Возвращает 0 для неквадратной матрицы или при нехватке памяти.
+*/
+int matrixc_determinant(const MatrixC *a, double *det_re, double *det_im) {
+    if (!a || a->rows != a->cols) {
+        fprintf(stderr, "Determinant: matrix is not square\n");
+        return 0;
+    }
+    size_t n = a->rows, nn = n * n;
+    double *re = malloc((nn ? nn : 1) * sizeof(double));
+    double *im = malloc((nn ? nn : 1) * sizeof(double));
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    if (!re || !im || !piv) { free(re); free(im); free(piv); return 0; }
+    memcpy(re, a->re, nn * sizeof(double));
+    memcpy(im, a->im, nn * sizeof(double));
+    double mr = 1.0, mi = 0.0;
+    long e2 = 0;
+    if (!lu_factor_c(re, im, n, piv, singular_tol_c(a))) {
+        mr = 0.0;
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            double pr = re[i * n + i], pi = im[i * n + i];
+            double t = mr * pr - mi * pi;
+            mi = mr * pi + mi * pr;
+            mr = t;
+            if (piv[i] != i) { mr = -mr; mi = -mi; }
+            int e;
+            frexp(fabs(mr) > fabs(mi) ? mr : mi, &e);
+            mr = ldexp(mr, -e);
+            mi = ldexp(mi, -e);
+            e2 += e;
+        }
+    }
+    int e = e2 > INT_MAX ? INT_MAX : (e2 < INT_MIN ? INT_MIN : (int)e2);
+    *det_re = ldexp(mr, e);
+    *det_im = ldexp(mi, e);
+    free(re); free(im); free(piv);
+    return 1;
+}
+
+/* Обратная комплексная матрица: LU, затем n прямых/обратных подстановок
+   с единичной правой частью (столбцы обрабатываются все разом, строками).
+   NULL, если матрица не квадратная или вырождена.
+*/
+MatrixC *matrixc_inverse(const MatrixC *a) {
+    if (!a || a->rows != a->cols) {
+        fprintf(stderr, "Inverse: matrix is not square\n");
+        return NULL;
+    }
+    size_t n = a->rows;
+    MatrixC *f = matrixc_create(n, n);
+    MatrixC *x = matrixc_create(n, n);
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    if (!f || !x || !piv) { matrixc_free(f); matrixc_free(x); free(piv); return NULL; }
+    memcpy(f->re, a->re, n * n * sizeof(double));
+    memcpy(f->im, a->im, n * n * sizeof(double));
+    if (!lu_factor_c(f->re, f->im, n, piv, singular_tol_c(a))) {
+        matrixc_free(f); matrixc_free(x); free(piv);
+        return NULL;
+    }
+    // X = P^T-переставленная единичная: строки переставляются так же, как в LU
+    for (size_t i = 0; i < n; ++i) x->re[i * n + i] = 1.0;
+    for (size_t i = 0; i < n; ++i)
+        if (piv[i] != i)
+            for (size_t c = 0; c < n; ++c) {
+                double t = x->re[i * n + c]; x->re[i * n + c] = x->re[piv[i] * n + c]; x->re[piv[i] * n + c] = t;
+            }
+    double *xr = x->re, *xi = x->im;
+    const double *lr = f->re, *li = f->im;
+    // L Y = P I (L с единичной диагональю)
+    for (size_t i = 0; i < n; ++i)
+        for (size_t p = 0; p < i; ++p) {
+            double fr = lr[i * n + p], fi = li[i * n + p];
+            if (fr == 0.0 && fi == 0.0) continue;
+            for (size_t c = 0; c < n; ++c) {
+                xr[i * n + c] -= fr * xr[p * n + c] - fi * xi[p * n + c];
+                xi[i * n + c] -= fr * xi[p * n + c] + fi * xr[p * n + c];
+            }
+        }
+    // U X = Y
+    for (size_t i = n; i-- > 0;) {
+        for (size_t p = i + 1; p < n; ++p) {
+            double fr = lr[i * n + p], fi = li[i * n + p];
+            for (size_t c = 0; c < n; ++c) {
+                xr[i * n + c] -= fr * xr[p * n + c] - fi * xi[p * n + c];
+                xi[i * n + c] -= fr * xi[p * n + c] + fi * xr[p * n + c];
+            }
+        }
+        double pr = lr[i * n + i], pi = li[i * n + i];
+        double s = fabs(pr) > fabs(pi) ? fabs(pr) : fabs(pi);
+        double qr = pr / s, qi = pi / s, d = s * (qr * qr + qi * qi);
+        double ir = qr / d, ii = -qi / d;
+        for (size_t c = 0; c < n; ++c) {
+            double t = xr[i * n + c] * ir - xi[i * n + c] * ii;
+            xi[i * n + c] = xr[i * n + c] * ii + xi[i * n + c] * ir;
+            xr[i * n + c] = t;
+        }
+    }
+    matrixc_free(f);
+    free(piv);
+    return x;
+}
+
+/* ====== Пакеты малых матриц ====== */
+
+/* Пакет из count матриц rows x cols в чередующейся SoA-раскладке:
+   матрицы идут блоками по MATRIX_BATCH_LANES, внутри блока элемент (i, j)
+   всех матриц блока лежит подряд:
+     data[((k / L) * rows * cols + i * cols + j) * L + k % L],  L = MATRIX_BATCH_LANES.
+   Внутренний цикл каждого ядра идёт по L соседним матрицам с постоянной
+   длиной, так что SIMD-полосы обрабатывают разные матрицы, а один блок
+   (для 8x8 — 4 КБ) целиком лежит в L1. count дополняется до кратного L
+   нулевыми матрицами.
+*/
+#define MATRIX_BATCH_LANES 8
+#define BATCH_GRAIN 16 // блоков на поток, не меньше
+
+/* Операции над L полосами одного элемента. С векторными расширениями
+   GCC/Clang L полос — один вектор, и каждая операция — одна инструкция
+   на ширину регистра; иначе обычный цикл постоянной длины.
+*/
+#ifdef MATRIXF_SIMD
+typedef double blanes __attribute__((vector_size(MATRIX_BATCH_LANES * sizeof(double)), aligned(8), __may_alias__));
+#define BLANES(p) (*(blanes *)(p))
+#define BLANES_C(p) (*(const blanes *)(p))
+#endif
+
+// x -= f * y
+static inline void lanes_fnma(double *restrict x, const double *restrict f, const double *restrict y) {
+#ifdef MATRIXF_SIMD
+    BLANES(x) -= BLANES_C(f) * BLANES_C(y);
+#else
+    for (size_t l = 0; l < MATRIX_BATCH_LANES; ++l) x[l] -= f[l] * y[l];
+#endif
+}
+
+// x += f * y
+static inline void lanes_fma(double *restrict x, const double *restrict f, const double *restrict y) {
+#ifdef MATRIXF_SIMD
+    BLANES(x) += BLANES_C(f) * BLANES_C(y);
+#else
+    for (size_t l = 0; l < MATRIX_BATCH_LANES; ++l) x[l] += f[l] * y[l];
+#endif
+}
+
+// out = sum_p a[p * sa] * b[p * sb] (шаги в элементах, по L полос каждый)
+static inline void lanes_dot(double *restrict out, const double *a, size_t sa,
+                             const double *b, size_t sb, size_t len) {
+#ifdef MATRIXF_SIMD
+    blanes acc = {0};
+    for (size_t p = 0; p < len; ++p)
+        acc += BLANES_C(a + p * sa * MATRIX_BATCH_LANES) * BLANES_C(b + p * sb * MATRIX_BATCH_LANES);
+    BLANES(out) = acc;
+#else
+    double acc[MATRIX_BATCH_LANES] = {0};
+    for (size_t p = 0; p < len; ++p)
+        lanes_fma(acc, a + p * sa * MATRIX_BATCH_LANES, b + p * sb * MATRIX_BATCH_LANES);
+    memcpy(out, acc, sizeof(acc));
+#endif
+}
+
+// x *= s
+static inline void lanes_mul(double *restrict x, const double *restrict s) {
+#ifdef MATRIXF_SIMD
+    BLANES(x) *= BLANES_C(s);
+#else
+    for (size_t l = 0; l < MATRIX_BATCH_LANES; ++l) x[l] *= s[l];
+#endif
+}
+
+typedef struct {
+    size_t count;
+    size_t rows;
+    size_t cols;
+    double *data;
+} MatrixBatch;
+
+static size_t batch_blocks(const MatrixBatch *b) {
+    return (b->count + MATRIX_BATCH_LANES - 1) / MATRIX_BATCH_LANES;
+}
+
+MatrixBatch *matrix_batch_create(size_t count, size_t rows, size_t cols) {
+    MatrixBatch *b = malloc(sizeof(MatrixBatch));
+    if (!b) return NULL;
+    b->count = count;
+    b->rows = rows;
+    b->cols = cols;
+    size_t len = batch_blocks(b) * MATRIX_BATCH_LANES * rows * cols;
+    b->data = calloc(len ? len : 1, sizeof(double));
+    if (!b->data) { free(b); return NULL; }
+    return b;
+}
+
+void matrix_batch_free(MatrixBatch *b) {
+    if (!b) return;
+    free(b->data);
+    free(b);
+}
+
+static double *batch_elem(const MatrixBatch *b, size_t k, size_t i, size_t j) {
+    return b->data + ((k / MATRIX_BATCH_LANES) * b->rows * b->cols + i * b->cols + j) * MATRIX_BATCH_LANES
+           + k % MATRIX_BATCH_LANES;
+}
+
+double matrix_batch_get(const MatrixBatch *b, size_t k, size_t i, size_t j) {
+    return *batch_elem(b, k, i, j);
+}
+
+void matrix_batch_set(MatrixBatch *b, size_t k, size_t i, size_t j, double v) {
+    *batch_elem(b, k, i, j) = v;
+}
+
+/* Копирование k-й матрицы пакета в/из обычной Matrix */
+int matrix_batch_pack(MatrixBatch *b, size_t k, const Matrix *m) {
+    if (!b || !m || k >= b->count || m->rows != b->rows || m->cols != b->cols) return 0;
+    for (size_t i = 0; i < m->rows; ++i)
+        for (size_t j = 0; j < m->cols; ++j)
+            *batch_elem(b, k, i, j) = m->data[i * m->cols + j];
+    return 1;
+}
+
+Matrix *matrix_batch_unpack(const MatrixBatch *b, size_t k) {
+    if (!b || k >= b->count) return NULL;
+    Matrix *m = matrix_create(b->rows, b->cols);
+    if (!m) return NULL;
+    for (size_t i = 0; i < b->rows; ++i)
+        for (size_t j = 0; j < b->cols; ++j)
+            m->data[i * b->cols + j] = *batch_elem(b, k, i, j);
+    return m;
+}
+
+typedef struct {
+    const MatrixBatch *a, *b;
+    MatrixBatch *c;
+    double *det;
+    int *info;
+    atomic_int failed; // нехватка памяти в любом из кусков
+} BatchCtx;
+
+static void batch_multiply_range(size_t lo, size_t hi, void *arg) {
+    BatchCtx *t = arg;
+    const size_t L = MATRIX_BATCH_LANES;
+    size_t m = t->a->rows, kk = t->a->cols, n = t->b->cols;
+    for (size_t blk = lo; blk < hi; ++blk) {
+        const double *A = t->a->data + blk * m * kk * L;
+        const double *B = t->b->data + blk * kk * n * L;
+        double *C = t->c->data + blk * m * n * L;
+        for (size_t i = 0; i < m; ++i)
+            for (size_t j = 0; j < n; ++j)
+                lanes_dot(C + (i * n + j) * L, A + i * kk * L, 1, B + j * L, n, kk);
+    }
+}
+
+/* C_k = A_k * B_k для всех k */
+MatrixBatch *matrix_batch_multiply(const MatrixBatch *a, const MatrixBatch *b) {
+    if (!a || !b || a->count != b->count || a->cols != b->rows) return NULL;
+    MatrixBatch *c = matrix_batch_create(a->count, a->rows, b->cols);
+    if (!c) return NULL;
+    BatchCtx ctx = {a, b, c, NULL, NULL, 0};
+    parallel_for(batch_blocks(a), BATCH_GRAIN, batch_multiply_range, &ctx);
+    return c;
+}
+
+/* Исключение Гаусса с выбором опорного элемента независимо в каждой полосе
+   одного блока: W — n x w элементов по L полос (n x n матрица, справа
+   w - n столбцов правых частей). После вызова W содержит U и преобразованные
+   правые части; det[l] — детерминант, sing[l] = 1 для вырожденной полосы
+   (опорный элемент <= n * eps * max|a|, заменяется на 1, чтобы остальные
+   полосы считались без NaN).
+*/
+static void batch_eliminate(double *W, size_t n, size_t w, double *det, int *sing) {
+    const size_t L = MATRIX_BATCH_LANES;
+    double tol[MATRIX_BATCH_LANES] = {0};
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            for (size_t l = 0; l < L; ++l)
+                if (fabs(W[(i * w + j) * L + l]) > tol[l]) tol[l] = fabs(W[(i * w + j) * L + l]);
+    for (size_t l = 0; l < L; ++l) {
+        tol[l] *= (double)n * DBL_EPSILON;
+        det[l] = 1.0;
+        sing[l] = 0;
+    }
+    for (size_t k = 0; k < n; ++k) {
+        size_t piv[MATRIX_BATCH_LANES];
+        double best[MATRIX_BATCH_LANES];
+        for (size_t l = 0; l < L; ++l) { piv[l] = k; best[l] = fabs(W[(k * w + k) * L + l]); }
+        for (size_t r = k + 1; r < n; ++r)
+            for (size_t l = 0; l < L; ++l) {
+                double v = fabs(W[(r * w + k) * L + l]);
+                if (v > best[l]) { best[l] = v; piv[l] = r; }
+            }
+        // перестановка строк — своя в каждой полосе, O(w) на полосу
+        for (size_t l = 0; l < L; ++l) {
+            if (piv[l] != k) {
+                det[l] = -det[l];
+                for (size_t c = k; c < w; ++c) {
+                    double t = W[(k * w + c) * L + l];
+                    W[(k * w + c) * L + l] = W[(piv[l] * w + c) * L + l];
+                    W[(piv[l] * w + c) * L + l] = t;
+                }
+            }
+            if (!(best[l] > tol[l])) {
+                sing[l] = 1;
+                W[(k * w + k) * L + l] = 1.0;
+            }
+        }
+        double inv[MATRIX_BATCH_LANES];
+        const double *pk = W + (k * w + k) * L;
+        for (size_t l = 0; l < L; ++l) { det[l] *= pk[l]; inv[l] = 1.0 / pk[l]; }
+        for (size_t r = k + 1; r < n; ++r) {
+            double f[MATRIX_BATCH_LANES];
+            double *rk = W + (r * w + k) * L;
+            for (size_t l = 0; l < L; ++l) f[l] = rk[l] * inv[l];
+            for (size_t c = k + 1; c < w; ++c)
+                lanes_fnma(W + (r * w + c) * L, f, W + (k * w + c) * L);
+        }
+    }
+    for (size_t l = 0; l < L; ++l)
+        if (sing[l]) det[l] = 0.0;
+}
+
+/* Обратная подстановка по U из batch_eliminate для столбцов n..w-1 */
+static void batch_back_substitute(double *W, size_t n, size_t w) {
+    const size_t L = MATRIX_BATCH_LANES;
+    for (size_t i = n; i-- > 0;) {
+        double inv[MATRIX_BATCH_LANES];
+        for (size_t l = 0; l < L; ++l) inv[l] = 1.0 / W[(i * w + i) * L + l];
+        for (size_t c = n; c < w; ++c) {
+            double *x = W + (i * w + c) * L;
+            for (size_t p = i + 1; p < n; ++p)
+                lanes_fnma(x, W + (i * w + p) * L, W + (p * w + c) * L);
+            lanes_mul(x, inv);
+        }
+    }
+}
+
+/* Общий проход для det / inverse / solve: W = [A_blk | B_blk или I],
+   результат — в t->c (столбцы правых частей), t->det, t->info
+*/
+static void batch_solve_range(size_t lo, size_t hi, void *arg) {
+    BatchCtx *t = arg;
+    const size_t L = MATRIX_BATCH_LANES;
+    size_t n = t->a->rows;
+    size_t nrhs = t->c ? t->c->cols : 0, w = n + nrhs;
+    size_t wl = n * w * L;
+    double *W = malloc((wl ? wl : 1) * sizeof(double));
+    if (!W) { atomic_store_explicit(&t->failed, 1, memory_order_relaxed); return; }
+    for (size_t blk = lo; blk < hi; ++blk) {
+        const double *A = t->a->data + blk * n * n * L;
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(W + i * w * L, A + i * n * L, n * L * sizeof(double));
+            double *r = W + (i * w + n) * L;
+            if (t->b) memcpy(r, t->b->data + (blk * n + i) * nrhs * L, nrhs * L * sizeof(double));
+            else if (nrhs) {
+                memset(r, 0, nrhs * L * sizeof(double));
+                for (size_t l = 0; l < L; ++l) r[i * L + l] = 1.0;
+            }
+        }
+        double det[MATRIX_BATCH_LANES];
+        int sing[MATRIX_BATCH_LANES];
+        batch_eliminate(W, n, w, det, sing);
+        if (nrhs) {
+            batch_back_substitute(W, n, w);
+            double *X = t->c->data + blk * n * nrhs * L;
+            for (size_t i = 0; i < n; ++i)
+                memcpy(X + i * nrhs * L, W + (i * w + n) * L, nrhs * L * sizeof(double));
+            for (size_t l = 0; l < L; ++l)
+                if (sing[l])
+                    for (size_t e = 0; e < n * nrhs; ++e) X[e * L + l] = NAN;
+        }
+        size_t count = t->a->count;
+        for (size_t l = 0; l < L && blk * L + l < count; ++l) {
+            if (t->det) t->det[blk * L + l] = det[l];
+            if (t->info) t->info[blk * L + l] = !sing[l];
+        }
+    }
+    free(W);
+}
+
+/* Детерминанты всех матриц пакета в det[count]. 0 — не квадратные или память. */
+int matrix_batch_determinant(const MatrixBatch *a, double *det) {
+    if (!a || !det || a->rows != a->cols) return 0;
+    BatchCtx ctx = {a, NULL, NULL, det, NULL, 0};
+    parallel_for(batch_blocks(a), BATCH_GRAIN, batch_solve_range, &ctx);
+    return !ctx.failed;
+}
+
+/* Обратные матрицы. info[k] (если не NULL) = 0 для вырожденной A_k,
+   её обратная заполняется NaN.
+*/
+MatrixBatch *matrix_batch_inverse(const MatrixBatch *a, int *info) {
+    if (!a || a->rows != a->cols) return NULL;
+    MatrixBatch *c = matrix_batch_create(a->count, a->rows, a->cols);
+    if (!c) return NULL;
+    BatchCtx ctx = {a, NULL, c, NULL, info, 0};
+    parallel_for(batch_blocks(a), BATCH_GRAIN, batch_solve_range, &ctx);
+    if (ctx.failed) { matrix_batch_free(c); return NULL; }
+    return c;
+}
+
+/* Решение A_k X_k = B_k; info — как у matrix_batch_inverse */
+MatrixBatch *matrix_batch_solve(const MatrixBatch *a, const MatrixBatch *b, int *info) {
+    if (!a || !b || a->rows != a->cols || b->rows != a->rows || b->count != a->count) return NULL;
+    MatrixBatch *c = matrix_batch_create(a->count, b->rows, b->cols);
+    if (!c) return NULL;
+    BatchCtx ctx = {a, b, c, NULL, info, 0};
+    parallel_for(batch_blocks(a), BATCH_GRAIN, batch_solve_range, &ctx);
+    if (ctx.failed) { matrix_batch_free(c); return NULL; }
+    return c;
+}
+
+/* ====== Разложение Холецкого для симметричных положительно определённых ====== */
+
+/* Подсказка о структуре матрицы для обратной матрицы и детерминанта */
+typedef enum {
+    MATRIX_AUTO = 0,    // проверить симметрию и попробовать Холецкого, иначе LU
+    MATRIX_GENERAL = 1, // всегда LU с выбором опорного элемента
+    MATRIX_SPD = 2      // считать SPD без проверки (при неудаче — LU)
+} MatrixStructure;
+
+#define CHOL_NB 64
+
+/* Симметрия с относительным допуском и положительная диагональ —
+   необходимые условия SPD, проверка O(n^2). */
+int matrix_is_spd_candidate(const Matrix *a) {
+    if (!a || a->rows != a->cols) return 0;
+    size_t n = a->rows;
+    for (size_t i = 0; i < n; ++i) {
+        if (!(a->data[i * n + i] > 0.0)) return 0;
+        for (size_t j = 0; j < i; ++j) {
+            double x = a->data[i * n + j], y = a->data[j * n + i];
+            if (fabs(x - y) > 64 * DBL_EPSILON * (fabs(x) + fabs(y))) return 0;
+        }
+    }
+    return 1;
+}
+
+/* Блочный Холецкий A = L L^T на месте (используется нижний треугольник).
+   Для каждого блока столбцов: диагональный блок, затем панель под ним
+   (треугольное решение по строкам) и обновление хвоста L21 L21^T через
+   matrix_syrk — только нижний треугольник.
+   Возвращает 0, если матрица не положительно определена или вырождена:
+   опорный элемент d = l_jj^2 считается нулевым при d <= n * eps * max a_ii
+   (для SPD max|a_ij| достигается на диагонали — тот же порог, что singular_tol).
+*/
+static int chol_factor(double *a, size_t n, size_t lda) {
+    double amax = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        if (a[i * lda + i] > amax) amax = a[i * lda + i];
+    double tol = (double)n * DBL_EPSILON * amax;
+    for (size_t k = 0; k < n; k += CHOL_NB) {
+        size_t kb = (n - k < CHOL_NB) ? n - k : CHOL_NB;
+        for (size_t j = k; j < k + kb; ++j) {
+            double d = a[j * lda + j];
+            for (size_t p = k; p < j; ++p) d -= a[j * lda + p] * a[j * lda + p];
+            if (!(d > tol) || !isfinite(d)) return 0;
+            double ljj = sqrt(d);
+            a[j * lda + j] = ljj;
+            for (size_t i = j + 1; i < k + kb; ++i) {
+                double s = a[i * lda + j];
+                for (size_t p = k; p < j; ++p) s -= a[i * lda + p] * a[j * lda + p];
+                a[i * lda + j] = s / ljj;
+            }
+        }
+        // L21 = A21 * L11^{-T}
+        for (size_t i = k + kb; i < n; ++i) {
+            double *ai = a + i * lda;
+            for (size_t j = k; j < k + kb; ++j) {
+                double s = ai[j];
+                for (size_t p = k; p < j; ++p) s -= ai[p] * a[j * lda + p];
+                ai[j] = s / a[j * lda + j];
+            }
+        }
+        // A22 -= L21 L21^T, только нижний треугольник
+        matrix_syrk(0, n - k - kb, kb, -1.0, a + (k + kb) * lda + k, lda,
+                    1.0, a + (k + kb) * lda + k + kb, lda);
+    }
+    return 1;
+}
+
+/* Обращение нижнетреугольной матрицы на месте: рекурсивно
+   X11 = L11^-1, X22 = L22^-1, X21 = -X22 L21 X11 (через matrix_gemm). */
+static int tri_lower_inverse(double *a, size_t n, size_t lda) {
+    if (n <= CHOL_NB) {
+        for (size_t j = 0; j < n; ++j) {
+            if (a[j * lda + j] == 0.0) return 0;
+            a[j * lda + j] = 1.0 / a[j * lda + j];
+        }
+        // строка i: X[i][j] = -X[i][i] * sum_{p=j}^{i-1} L[i][p] X[p][j]
+        double t[CHOL_NB];
+        for (size_t i = 1; i < n; ++i) {
+            for (size_t j = 0; j < i; ++j) t[j] = 0.0;
+            for (size_t p = 0; p < i; ++p) {
+                double lp = a[i * lda + p];
+                for (size_t j = 0; j <= p; ++j) t[j] += lp * a[p * lda + j];
+            }
+            for (size_t j = 0; j < i; ++j) a[i * lda + j] = -a[i * lda + i] * t[j];
+        }
+        return 1;
+    }
+    size_t n1 = n / 2, n2 = n - n1;
+    double *a21 = a + n1 * lda, *a22 = a + n1 * lda + n1;
+    if (!tri_lower_inverse(a, n1, lda) || !tri_lower_inverse(a22, n2, lda)) return 0;
+    double *tmp = malloc(n2 * n1 * sizeof(double));
+    if (!tmp) return 0;
+    matrix_gemm(0, 0, n2, n1, n1, 1.0, a21, lda, a, lda, 0.0, tmp, n1);
+    matrix_gemm(0, 0, n2, n1, n2, -1.0, a22, lda, tmp, n1, 0.0, a21, lda);
+    free(tmp);
+    return 1;
+}
+
+/* Множитель Холецкого L (нули над диагональю) или NULL, если не SPD */
+Matrix *matrix_cholesky(const Matrix *a) {
+    if (!a || a->rows != a->cols) return NULL;
+    Matrix *l = matrix_clone(a);
+    if (!l) return NULL;
+    size_t n = l->rows;
+    if (!chol_factor(l->data, n, n)) { matrix_free(l); return NULL; }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = i + 1; j < n; ++j) l->data[i * n + j] = 0.0;
+    return l;
+}
+
+/* log det A = 2 * sum log L_ii. Возвращает 0, если матрица не SPD. */
+int matrix_spd_logdet(const Matrix *a, double *logdet) {
+    Matrix *l = matrix_cholesky(a);
+    if (!l) return 0;
+    double s = 0.0;
+    for (size_t i = 0; i < l->rows; ++i) s += log(l->data[i * l->cols + i]);
+    *logdet = 2.0 * s;
+    matrix_free(l);
+    return 1;
+}
+
+/* Решение A X = B для SPD A: L Y = B, затем L^T X = Y. NULL, если не SPD. */
+Matrix *matrix_spd_solve(const Matrix *a, const Matrix *b) {
+    if (!a || !b || a->rows != a->cols || b->rows != a->rows) return NULL;
+    Matrix *l = matrix_cholesky(a);
+    if (!l) return NULL;
+    Matrix *x = matrix_clone(b);
+    if (!x) { matrix_free(l); return NULL; }
+    size_t n = a->rows, r = b->cols;
+    const double *L = l->data;
+    double *X = x->data;
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t p = 0; p < i; ++p) {
+            double lp = L[i * n + p];
+            for (size_t j = 0; j < r; ++j) X[i * r + j] -= lp * X[p * r + j];
+        }
+        for (size_t j = 0; j < r; ++j) X[i * r + j] /= L[i * n + i];
+    }
+    for (size_t i = n; i-- > 0;) {
+        for (size_t j = 0; j < r; ++j) X[i * r + j] /= L[i * n + i];
+        for (size_t p = 0; p < i; ++p) {
+            double lp = L[i * n + p];
+            for (size_t j = 0; j < r; ++j) X[p * r + j] -= lp * X[i * r + j];
+        }
+    }
+    matrix_free(l);
+    return x;
+}
+
+/* Обратная к SPD: A^-1 = L^-T L^-1. Нижний треугольник собирается блоками
+   через matrix_gemm и отражается наверх. NULL, если не SPD. */
+Matrix *matrix_spd_inverse(const Matrix *a) {
+    Matrix *l = matrix_cholesky(a);
+    if (!l) return NULL;
+    size_t n = l->rows;
+    Matrix *inv = matrix_create(n, n);
+    if (!inv || !tri_lower_inverse(l->data, n, n)) {
+        matrix_free(inv);
+        matrix_free(l);
+        return NULL;
+    }
+    const double *X = l->data;
+    for (size_t ib = 0; ib < n; ib += CHOL_NB) {
+        size_t rb = (n - ib < CHOL_NB) ? n - ib : CHOL_NB;
+        for (size_t jb = 0; jb <= ib; jb += CHOL_NB) {
+            size_t cb = (n - jb < CHOL_NB) ? n - jb : CHOL_NB;
+            // inv(I,J) = sum_{p >= I} X(p,I)^T X(p,J)
+            matrix_gemm(1, 0, rb, cb, n - ib, 1.0, X + ib * n + ib, n, X + ib * n + jb, n,
+                        0.0, inv->data + ib * n + jb, n);
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = i + 1; j < n; ++j) inv->data[i * n + j] = inv->data[j * n + i];
+    matrix_free(l);
+    return inv;
+}
+
+/* ====== Линейная алгебра: детерминант и обратная матрица ====== */
+
+/* Порог вырожденности относительно масштаба матрицы: опорный элемент
+   считается нулевым, если |u_kk| <= n * eps * max|a_ij|.
+*/
+static double singular_tol(const double *a, size_t n, size_t lda) {
+    double amax = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            if (fabs(a[i * lda + j]) > amax) amax = fabs(a[i * lda + j]);
+    return (double)n * DBL_EPSILON * amax;
+}
+
+/* LU-разложение с частичным выбором опорного элемента на месте: P A = L U.
+   piv[k] — строка, переставленная со строкой k на шаге k.
+   Возвращает 0, если опорный элемент <= tol (матрица вырождена).
+   Блочное (правостороннее): панель из LU_NB столбцов разлагается
+   построчными исключениями, затем U12 = L11^-1 A12 и A22 -= L21 U12
+   через matrix_gemm. При n <= LU_NB — в точности прежний поэлементный алгоритм.
+   При нескольких потоках и n >= LU_TILED_MIN — плиточный вариант на графе
+   задач (lu_factor_tiled), результат побитово тот же.
+*/
+#define LU_NB 64
+#define LU_TILED_MIN 256 // с этого n и при нескольких потоках — плиточный LU
+
+/* Панель: столбцы [c0, c0 + kb), строки [c0, n). Перестановки строк — только
+   в столбцах [s0, s1) (в блочном LU — вся строка, в плиточном — своя плитка). */
+static int lu_panel(double *a, size_t n, size_t lda, size_t *piv, double tol,
+                    size_t c0, size_t kb, size_t s0, size_t s1) {
+    for (size_t i = c0; i < c0 + kb; ++i) {
+        // Поиск опорного элемента (pivot)
+        size_t p = i;
+        for (size_t r = i; r < n; ++r)
+            if (fabs(a[r * lda + i]) > fabs(a[p * lda + i])) p = r;
+        piv[i] = p;
+        if (!(fabs(a[p * lda + i]) > tol)) return 0;
+        if (p != i) {
+            for (size_t c = s0; c < s1; ++c) {
+                double tmp = a[i * lda + c];
+                a[i * lda + c] = a[p * lda + c];
+                a[p * lda + c] = tmp;
+            }
+        }
+        double pivot = a[i * lda + i];
+        // нормируем и вычитаем (внутри панели)
+        for (size_t r = i + 1; r < n; ++r) {
+            double factor = a[r * lda + i] / pivot;
+            a[r * lda + i] = factor;
+            for (size_t c = i + 1; c < c0 + kb; ++c)
+                a[r * lda + c] -= factor * a[i * lda + c];
+        }
+    }
+    return 1;
+}
+
+/* Столбцы [s0, s1) после панели c0: U12 = L11^-1 A12, A22 -= L21 U12 */
+static void lu_update(double *a, size_t n, size_t lda, size_t c0, size_t kb, size_t s0, size_t s1) {
+    // L11 с единичной диагональю
+    for (size_t i = c0 + 1; i < c0 + kb; ++i)
+        for (size_t p = c0; p < i; ++p) {
+            double l = a[i * lda + p];
+            if (l == 0.0) continue;
+            for (size_t c = s0; c < s1; ++c) a[i * lda + c] -= l * a[p * lda + c];
+        }
+    if (c0 + kb < n)
+        matrix_gemm(0, 0, n - c0 - kb, s1 - s0, kb, -1.0, a + (c0 + kb) * lda + c0, lda,
+                    a + c0 * lda + s0, lda, 1.0, a + (c0 + kb) * lda + s0, lda);
+}
+
+/* Плиточный LU на графе задач. Задачи шага k: панель P(k) и обновления
+   U(k, j) столбцов-плиток j > k (перестановки строк шага k, TRSM, GEMM).
+   P(k) -> U(k, j); U(k, j) -> U(k+1, j); U(k, k+1) -> P(k+1).
+   Приоритет — номер столбца-плитки, поэтому P(k+1) запускается сразу после
+   U(k, k+1), не дожидаясь остальных обновлений шага k (lookahead).
+   Перестановки в уже готовых столбцах L делаются в конце.
+*/
+typedef struct {
+    double *a;
+    size_t n, lda, nt;
+    size_t *piv, *base; // base[k] — номер задачи P(k); U(k, j) = base[k] + j - k
+    double tol;
+    atomic_int failed;  // пишется в P(k); читают все задачи (relaxed): потомкам
+                        // P(k) запись видна через рёбра графа, остальные лишь
+                        // раньше прекращают работу, результат которой отброшен
+} LUTiles;
+
+static void lu_tile_task(size_t task, void *arg) {
+    LUTiles *t = arg;
+    size_t k = 0;
+    while (k + 1 < t->nt && t->base[k + 1] <= task) ++k;
+    size_t j = k + (task - t->base[k]);
+    if (atomic_load_explicit(&t->failed, memory_order_relaxed)) return;
+    size_t c0 = k * LU_NB, kb = (t->n - c0 < LU_NB) ? t->n - c0 : LU_NB;
+    if (j == k) {
+        if (!lu_panel(t->a, t->n, t->lda, t->piv, t->tol, c0, kb, c0, c0 + kb))
+            atomic_store_explicit(&t->failed, 1, memory_order_relaxed);
+        return;
+    }
+    size_t s0 = j * LU_NB, s1 = (t->n - s0 < LU_NB) ? t->n : s0 + LU_NB;
+    for (size_t i = c0; i < c0 + kb; ++i) {
+        size_t p = t->piv[i];
+        if (p == i) continue;
+        for (size_t c = s0; c < s1; ++c) {
+            double tmp = t->a[i * t->lda + c];
+            t->a[i * t->lda + c] = t->a[p * t->lda + c];
+            t->a[p * t->lda + c] = tmp;
+        }
+    }
+    lu_update(t->a, t->n, t->lda, c0, kb, s0, s1);
+}
+
+/* 1 — успех, 0 — вырождена, -1 — нет памяти (a не изменена) */
+static int lu_factor_tiled(double *a, size_t n, size_t lda, size_t *piv, double tol) {
+    LUTiles t = { a, n, lda, (n + LU_NB - 1) / LU_NB, piv, NULL, tol, 0 };
+    atomic_init(&t.failed, 0);
+    t.base = malloc(t.nt * sizeof(size_t));
+    if (!t.base) return -1;
+    size_t count = 0;
+    for (size_t k = 0; k < t.nt; ++k) { t.base[k] = count; count += t.nt - k; }
+    TaskGraph *g = task_graph_create(count, lu_tile_task, &t);
+    int ok = g != NULL;
+    for (size_t k = 0; ok && k < t.nt; ++k)
+        for (size_t j = k; ok && j < t.nt; ++j) {
+            size_t id = t.base[k] + j - k;
+            g->prio[id] = (long)j;
+            task_graph_owner(g, id, j); // столбец плиток j — за одним потоком
+            if (j > k) ok = task_graph_edge(g, t.base[k], id);
+            if (ok && k > 0) ok = task_graph_edge(g, t.base[k - 1] + j - (k - 1), id);
+        }
+    if (ok) ok = task_graph_run(g);
+    task_graph_free(g);
+    free(t.base);
+    if (!ok) return -1;
+    if (atomic_load_explicit(&t.failed, memory_order_relaxed)) return 0;
+    // перестановки шага k в столбцах L левее панели
+    for (size_t k = 1; k < t.nt; ++k)
+        for (size_t i = k * LU_NB; i < n && i < (k + 1) * LU_NB; ++i) {
+            size_t p = piv[i];
+            if (p == i) continue;
+            for (size_t c = 0; c < k * LU_NB; ++c) {
+                double tmp = a[i * lda + c];
+                a[i * lda + c] = a[p * lda + c];
+                a[p * lda + c] = tmp;
+            }
+        }
+    return 1;
+}
+
+static int lu_factor(double *a, size_t n, size_t lda, size_t *piv, double tol) {
+    size_t nt = (size_t)matrix_num_threads();
+    if (nt > 1 && n >= LU_TILED_MIN) {
+        int r = lu_factor_tiled(a, n, lda, piv, tol);
+        if (r >= 0) return r;
+    }
+    for (size_t k = 0; k < n; k += LU_NB) {
+        size_t kb = (n - k < LU_NB) ? n - k : LU_NB;
+        if (!lu_panel(a, n, lda, piv, tol, k, kb, 0, n)) return 0;
+        if (k + kb < n) lu_update(a, n, lda, k, kb, k + kb, n);
+    }
+    return 1;
+}
+
+/* B := B X (справа) и B := X B (слева) для верхнетреугольной X на месте,
+   рекурсивно: внедиагональный блок — через matrix_gemm, буферов нет.
+   B — m x n (справа: X n x n; слева: X m x m).
+*/
+static void trmm_upper_right(double *b, size_t m, size_t n, size_t ldb, const double *x, size_t ldx) {
+    if (n <= LU_NB) {
+        // столбец j результата = sum_{p<=j} B[:,p] X[p][j]; идём справа налево
+        for (size_t i = 0; i < m; ++i) {
+            double *bi = b + i * ldb;
+            for (size_t j = n; j-- > 0;) {
+                double s = 0.0;
+                for (size_t p = 0; p <= j; ++p) s += bi[p] * x[p * ldx + j];
+                bi[j] = s;
+            }
+        }
+        return;
+    }
+    size_t n1 = n / 2, n2 = n - n1;
+    // [B1 B2] X = [B1 X11, B1 X12 + B2 X22]
+    trmm_upper_right(b + n1, m, n2, ldb, x + n1 * ldx + n1, ldx);
+    matrix_gemm(0, 0, m, n2, n1, 1.0, b, ldb, x + n1, ldx, 1.0, b + n1, ldb);
+    trmm_upper_right(b, m, n1, ldb, x, ldx);
+}
+
+static void trmm_upper_left(double *b, size_t m, size_t n, size_t ldb, const double *x, size_t ldx) {
+    if (m <= LU_NB) {
+        // строка i результата = sum_{p>=i} X[i][p] B[p,:]; идём сверху вниз
+        for (size_t i = 0; i < m; ++i) {
+            double *bi = b + i * ldb;
+            double xi = x[i * ldx + i];
+            for (size_t j = 0; j < n; ++j) bi[j] *= xi;
+            for (size_t p = i + 1; p < m; ++p) {
+                double xp = x[i * ldx + p];
+                if (xp == 0.0) continue;
+                for (size_t j = 0; j < n; ++j) bi[j] += xp * b[p * ldb + j];
+            }
+        }
+        return;
+    }
+    size_t m1 = m / 2, m2 = m - m1;
+    // [X11 X12; 0 X22] [B1; B2] = [X11 B1 + X12 B2; X22 B2]
+    trmm_upper_left(b, m1, n, ldb, x, ldx);
+    matrix_gemm(0, 0, m1, n, m2, 1.0, x + m1, ldx, b + m1 * ldb, ldb, 1.0, b, ldb);
+    trmm_upper_left(b + m1 * ldb, m2, n, ldb, x + m1 * ldx + m1, ldx);
+}
+
+/* Обращение верхнетреугольной матрицы на месте (ниже диагонали не трогается):
+   X11 = U11^-1, X22 = U22^-1, X12 = -X11 U12 X22. */
+static int tri_upper_inverse(double *a, size_t n, size_t lda) {
+    if (n <= LU_NB) {
+        for (size_t j = 0; j < n; ++j) {
+            if (a[j * lda + j] == 0.0) return 0;
+            a[j * lda + j] = 1.0 / a[j * lda + j];
+        }
+        // столбец j: X[i][j] = -X[j][j] * sum_{p=i}^{j-1} X[i][p] U[p][j], i < j
+        for (size_t j = 1; j < n; ++j)
+            for (size_t i = 0; i < j; ++i) {
+                double s = 0.0;
+                for (size_t p = i; p < j; ++p) s += a[i * lda + p] * a[p * lda + j];
+                a[i * lda + j] = -a[j * lda + j] * s;
+            }
+        return 1;
+    }
+    size_t n1 = n / 2, n2 = n - n1;
+    double *a12 = a + n1, *a22 = a + n1 * lda + n1;
+    if (!tri_upper_inverse(a, n1, lda) || !tri_upper_inverse(a22, n2, lda)) return 0;
+    trmm_upper_right(a12, n1, n2, lda, a22, lda);
+    trmm_upper_left(a12, n1, n2, lda, a, lda);
+    for (size_t i = 0; i < n1; ++i)
+        for (size_t j = 0; j < n2; ++j) a12[i * lda + j] = -a12[i * lda + j];
+    return 1;
+}
+
+/* Обратная по LU на месте (как LAPACK getri): в a — множители из lu_factor.
+   U -> U^-1, затем X L = U^-1 решается блоками столбцов справа налево:
+   столбцы L текущего блока копируются в рабочую панель n x LU_NB, сам
+   блок X обновляется через matrix_gemm и треугольную подстановку.
+   В конце — перестановка столбцов в обратном порядке. Дополнительная память
+   O(n * LU_NB) вместо n x 2n. Возвращает 0 при нехватке памяти.
+*/
+static int lu_inverse_inplace(double *a, size_t n, size_t lda, const size_t *piv) {
+    if (!tri_upper_inverse(a, n, lda)) return 0;
+    size_t nb = n < LU_NB ? n : LU_NB;
+    if (n == 0) return 1;
+    double *w = malloc(n * nb * sizeof(double));
+    if (!w) return 0;
+    for (size_t blk = (n + LU_NB - 1) / LU_NB; blk-- > 0;) {
+        size_t jj = blk * LU_NB;
+        size_t jb = (n - jj < LU_NB) ? n - jj : LU_NB;
+        // панель L: w[i][c] = L[i][jj + c] для i > jj + c, в a — нули
+        for (size_t i = jj; i < n; ++i)
+            for (size_t c = 0; c < jb; ++c) {
+                if (i > jj + c) {
+                    w[i * jb + c] = a[i * lda + jj + c];
+                    a[i * lda + jj + c] = 0.0;
+                } else {
+                    w[i * jb + c] = 0.0;
+                }
+            }
+        // X[:, jj:jj+jb] -= X[:, jj+jb:n] L[jj+jb:n, jj:jj+jb]
+        if (jj + jb < n)
+            matrix_gemm(0, 0, n, jb, n - jj - jb, -1.0, a + jj + jb, lda,
+                        w + (jj + jb) * jb, jb, 1.0, a + jj, lda);
+        // X[:, jj:jj+jb] L11^-1 (L11 с единичной диагональю), столбцы справа налево
+        for (size_t i = 0; i < n; ++i) {
+            double *xi = a + i * lda + jj;
+            for (size_t c = jb; c-- > 0;)
+                for (size_t t = c + 1; t < jb; ++t) xi[c] -= xi[t] * w[(jj + t) * jb + c];
+        }
+    }
+    free(w);
+    // X = A^-1 P: переставляем столбцы в обратном порядке
+    for (size_t j = n; j-- > 0;) {
+        if (piv[j] == j) continue;
+        for (size_t i = 0; i < n; ++i) {
+            double t = a[i * lda + j];
+            a[i * lda + j] = a[i * lda + piv[j]];
+            a[i * lda + piv[j]] = t;
+        }
+    }
+    return 1;
+}
+
+/* Накопление произведения в виде mant * 2^exp2 без переполнения */
+static void det_accumulate(double *mant, long *exp2, double x) {
+    int e1, e2;
+    double m = frexp(fabs(x), &e1);
+    *mant = frexp(*mant * m, &e2);
+    *exp2 += (long)e1 + e2;
+}
+
+/* Один проход факторизации для всех вариантов детерминанта:
+   det = sign * mant * 2^exp2, mant в [0.5, 1). Для вырожденной матрицы sign = 0.
+   Возвращает 0 при ошибке (не квадратная, память).
+*/
+static int det_factor(const Matrix *a, MatrixStructure structure, int *sign, double *mant, long *exp2) {
+    *sign = 0;
+    *mant = 0.0;
+    *exp2 = 0;
+    if (!a) return 0;
+    if (a->rows != a->cols) {
+        fprintf(stderr, "Determinant: matrix is not square\n");
+        return 0;
+    }
+    size_t n = a->rows;
+    // Копируем в рабочую матрицу; для малых n — на стеке
+    double small_mat[SMALL_N_MAX * SMALL_N_MAX];
+    size_t small_piv[SMALL_N_MAX];
+    int small = n > 0 && n <= SMALL_N_MAX;
+    double *mat = small ? small_mat : malloc((n ? n * n : 1) * sizeof(double));
+    size_t *piv = small ? small_piv : malloc((n ? n : 1) * sizeof(size_t));
+    if (!mat || !piv) {
+        if (!small) { free(mat); free(piv); }
+        return 0;
+    }
+    memcpy(mat, a->data, n * n * sizeof(double));
+    double m = 0.5; // 1 = 0.5 * 2^1
+    long e = 1;
+    int sg = 1;
+    int done = 0;
+    if (structure == MATRIX_SPD || (structure == MATRIX_AUTO && matrix_is_spd_candidate(a))) {
+        // det = prod L_ii^2
+        if (chol_factor(mat, n, n)) {
+            for (size_t i = 0; i < n; ++i) {
+                det_accumulate(&m, &e, mat[i * n + i]);
+                det_accumulate(&m, &e, mat[i * n + i]);
+            }
+            done = 1;
+        } else {
+            memcpy(mat, a->data, n * n * sizeof(double));
+        }
+    }
+    if (!done) {
+        double tol = singular_tol(a->data, n, n);
+        if (!(small ? small_kernels[n].lu(mat, piv, tol) : lu_factor(mat, n, n, piv, tol))) {
+            sg = 0;
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                if (piv[i] != i) sg = -sg;
+                if (mat[i * n + i] < 0.0) sg = -sg;
+                det_accumulate(&m, &e, mat[i * n + i]);
+            }
+        }
+    }
+    if (!small) {
+        free(mat);
+        free(piv);
+    }
+    *sign = sg;
+    if (sg != 0) {
+        *mant = m;
+        *exp2 = e;
+    }
+    return 1;
+}
+
+/* Вычисление детерминанта квадратной матрицы методом приведения к верхней треугольной форме.
+   Возвращает 0 если не квадратная или вырожденная (порог относительный, см. singular_tol).
+   Работает с копией матрицы (не изменяет входную). Произведение опорных элементов
+   накапливается в масштабированном виде, поэтому inf/0 получается только если
+   сам детерминант не представим в double.
+   Для SPD-матриц (structure = MATRIX_SPD или распознанных при MATRIX_AUTO)
+   det = prod L_ii^2 по разложению Холецкого.
+*/
+double matrix_determinant_ex(const Matrix *a, MatrixStructure structure) {
+    int sign;
+    double mant;
+    long exp2;
+    if (!det_factor(a, structure, &sign, &mant, &exp2) || sign == 0) return 0.0;
+    if (exp2 > INT_MAX) exp2 = INT_MAX;
+    if (exp2 < INT_MIN) exp2 = INT_MIN;
+    return sign * ldexp(mant, (int)exp2);
+}
+
+double matrix_determinant(const Matrix *a) {
+    return matrix_determinant_ex(a, MATRIX_AUTO);
+}
+
+/* Логарифм модуля детерминанта: det = sign * exp(результат).
+   Для вырожденной матрицы sign = 0 и результат -INFINITY.
+*/
+double matrix_logdet(const Matrix *a, int *sign) {
+    int sg;
+    double mant;
+    long exp2;
+    if (!det_factor(a, MATRIX_AUTO, &sg, &mant, &exp2)) sg = 0;
+    if (sign) *sign = sg;
+    if (sg == 0) return -INFINITY;
+    return log(mant) + (double)exp2 * log(2.0);
+}
+
+/* Масштабированный детерминант: det = mantissa * 2^exponent, |mantissa| в [0.5, 1).
+   Возвращает 0 при ошибке; для вырожденной матрицы mantissa = 0.
+*/
+int matrix_det_scaled(const Matrix *a, double *mantissa, long *exponent) {
+    int sg;
+    double mant;
+    long exp2;
+    if (!det_factor(a, MATRIX_AUTO, &sg, &mant, &exp2)) return 0;
+    *mantissa = sg * mant;
+    *exponent = exp2;
+    return 1;
+}
+
+/* Обратная матрица: LU с выбором опорного элемента, затем обращение на
+   месте (lu_inverse_inplace); для n <= 8 — те же шаги с развёрнутыми циклами.
+   Возвращает NULL, если матрица не квадратная или необратима.
+   SPD-матрицы обращаются через Холецкого (matrix_spd_inverse).
+*/
+Matrix *matrix_inverse_ex(const Matrix *a, MatrixStructure structure) {
+    if (!a) return NULL;
+    if (a->rows != a->cols) {
+        fprintf(stderr, "Inverse: matrix is not square\n");
+        return NULL;
+    }
+    if (structure == MATRIX_SPD || (structure == MATRIX_AUTO && matrix_is_spd_candidate(a))) {
+        Matrix *inv = matrix_spd_inverse(a);
+        if (inv) return inv;
+    }
+    size_t n = a->rows;
+    if (n > 0 && n <= SMALL_N_MAX) {
+        Matrix *inv = matrix_create(n, n);
+        if (!inv) return NULL;
+        if (!small_kernels[n].inverse(a->data, inv->data, singular_tol(a->data, n, n))) {
+            matrix_free(inv);
+            return NULL; // сингулярная матрица
+        }
+        return inv;
+    }
+    // LU на месте в выходной матрице, затем U^-1 и X L = U^-1
+    Matrix *inv = matrix_clone(a);
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    if (!inv || !piv || !lu_factor(inv->data, n, n, piv, singular_tol(a->data, n, n))
+        || !lu_inverse_inplace(inv->data, n, n, piv)) {
+        matrix_free(inv);
+        free(piv);
+        return NULL; // сингулярная матрица или нехватка памяти
+    }
+    free(piv);
+    return inv;
+}
+
+Matrix *matrix_inverse(const Matrix *a) {
+    return matrix_inverse_ex(a, MATRIX_AUTO);
+}
+
+/* ====== QR-разложение (Хаусхолдер) и метод наименьших квадратов ====== */
+
+#define QR_NB 32
+
+/* Отражение Хаусхолдера H = I - tau v v^T, v[0] = 1, такое что H x = beta e1.
+   x[0] заменяется на beta, x[1..] — на хвост v. Элементы x идут с шагом stride.
+*/
+static void householder(double *x, size_t len, size_t stride, double *tau) {
+    *tau = 0.0;
+    if (len <= 1) return;
+    double scale = 0.0, ssq = 1.0;
+    for (size_t i = 1; i < len; ++i) {
+        double v = fabs(x[i * stride]);
+        if (v == 0.0) continue;
+        if (scale < v) { ssq = 1.0 + ssq * (scale / v) * (scale / v); scale = v; }
+        else ssq += (v / scale) * (v / scale);
+    }
+    double xnorm = scale * sqrt(ssq);
+    if (xnorm == 0.0) return;
+    double alpha = x[0];
+    double beta = -copysign(hypot(alpha, xnorm), alpha);
+    *tau = (beta - alpha) / beta;
+    double inv = 1.0 / (alpha - beta);
+    for (size_t i = 1; i < len; ++i) x[i * stride] *= inv;
+    x[0] = beta;
+}
+
+/* Копия блока векторов Хаусхолдера (столбцы j..j+kb) в плотный буфер V
+   (m - j) x kb с единичной диагональю, и треугольный множитель T компактного
+   WY-представления: H_j ... H_{j+kb-1} = I - V T V^T.
+*/
+static void qr_block_vt(const double *a, size_t m, size_t lda, size_t j, size_t kb,
+                        const double *tau, double *V, double *T) {
+    size_t mr = m - j;
+    for (size_t r = 0; r < mr; ++r)
+        for (size_t c = 0; c < kb; ++c)
+            V[r * kb + c] = (r == c) ? 1.0 : (r < c ? 0.0 : a[(j + r) * lda + j + c]);
+    for (size_t i = 0; i < kb; ++i) {
+        double ti = tau[j + i];
+        for (size_t p = 0; p < kb; ++p) T[p * kb + i] = 0.0;
+        T[i * kb + i] = ti;
+        if (ti == 0.0 || i == 0) continue;
+        // z = V(:, 0:i)^T v_i, затем T(0:i, i) = -tau_i T(0:i, 0:i) z
+        double z[QR_NB];
+        for (size_t p = 0; p < i; ++p) z[p] = 0.0;
+        for (size_t r = i; r < mr; ++r) {
+            double vi = V[r * kb + i];
+            for (size_t p = 0; p < i; ++p) z[p] += V[r * kb + p] * vi;
+        }
+        for (size_t p = 0; p < i; ++p) {
+            double s = 0.0;
+            for (size_t q = p; q < i; ++q) s += T[p * kb + q] * z[q];
+            T[p * kb + i] = -ti * s;
+        }
+    }
+}
+
+/* C := (I - V T V^T) C  (trans = 0)  или  C := (I - V T V^T)^T C  (trans = 1).
+   Все три произведения — через matrix_gemm.
+*/
+static int apply_block_reflector(int trans, size_t mr, size_t nc, size_t kb,
+                                 const double *V, const double *T, double *C, size_t ldc) {
+    if (nc == 0 || kb == 0) return 1;
+    double *W = malloc(kb * nc * sizeof(double));
+    double *W2 = malloc(kb * nc * sizeof(double));
+    if (!W || !W2) { free(W); free(W2); return 0; }
+    matrix_gemm(1, 0, kb, nc, mr, 1.0, V, kb, C, ldc, 0.0, W, nc);
+    matrix_gemm(trans, 0, kb, nc, kb, 1.0, T, kb, W, nc, 0.0, W2, nc);
+    matrix_gemm(0, 0, mr, nc, kb, -1.0, V, kb, W2, nc, 1.0, C, ldc);
+    free(W);
+    free(W2);
+    return 1;
+}
+
+/* Блочное QR на месте для m x n: R в верхнем треугольнике, векторы
+   Хаусхолдера под диагональю, tau длины min(m, n). Панель шириной QR_NB
+   раскладывается поотражательно, хвост обновляется блочным отражением.
+*/
+static int qr_factor(double *a, size_t m, size_t n, size_t lda, double *tau) {
+    size_t k = m < n ? m : n;
+    double *V = malloc((m ? m : 1) * QR_NB * sizeof(double));
+    double *T = malloc(QR_NB * QR_NB * sizeof(double));
+    double *w = malloc(QR_NB * sizeof(double));
+    if (!V || !T || !w) { free(V); free(T); free(w); return 0; }
+    int ok = 1;
+    for (size_t j = 0; j < k && ok; j += QR_NB) {
+        size_t kb = (k - j < QR_NB) ? k - j : QR_NB;
+        for (size_t c = j; c < j + kb; ++c) {
+            householder(a + c * lda + c, m - c, lda, &tau[c]);
+            size_t nl = j + kb - c - 1;
+            if (tau[c] == 0.0 || nl == 0) continue;
+            // H_c к столбцам панели справа: w = v^T A, A -= tau v w^T
+            double *row = a + c * lda + c + 1;
+            for (size_t l = 0; l < nl; ++l) w[l] = row[l];
+            for (size_t r = c + 1; r < m; ++r) {
+                double vr = a[r * lda + c];
+                for (size_t l = 0; l < nl; ++l) w[l] += vr * a[r * lda + c + 1 + l];
+            }
+            for (size_t l = 0; l < nl; ++l) row[l] -= tau[c] * w[l];
+            for (size_t r = c + 1; r < m; ++r) {
+                double f = tau[c] * a[r * lda + c];
+                for (size_t l = 0; l < nl; ++l) a[r * lda + c + 1 + l] -= f * w[l];
+            }
+        }
+        if (j + kb < n) {
+            qr_block_vt(a, m, lda, j, kb, tau, V, T);
+            ok = apply_block_reflector(1, m - j, n - j - kb, kb, V, T, a + j * lda + j + kb, lda);
+        }
+    }
+    free(V); free(T); free(w);
+    return ok;
+}
+
+/* C (m x nc) := Q C (trans = 0) или Q^T C (trans = 1), где Q = H_0 ... H_{k-1}
+   из qr_factor. Применяется блоками по QR_NB отражений.
+*/
+static int qr_apply_q(int trans, const double *a, size_t m, size_t k, size_t lda,
+                      const double *tau, double *C, size_t nc, size_t ldc) {
+    double *V = malloc((m ? m : 1) * QR_NB * sizeof(double));
+    double *T = malloc(QR_NB * QR_NB * sizeof(double));
+    if (!V || !T) { free(V); free(T); return 0; }
+    size_t nblocks = (k + QR_NB - 1) / QR_NB;
+    int ok = 1;
+    for (size_t b = 0; b < nblocks && ok; ++b) {
+        size_t j = (trans ? b : nblocks - 1 - b) * QR_NB;
+        size_t kb = (k - j < QR_NB) ? k - j : QR_NB;
+        qr_block_vt(a, m, lda, j, kb, tau, V, T);
+        ok = apply_block_reflector(trans, m - j, nc, kb, V, T, C + j * ldc, ldc);
+    }
+    free(V); free(T);
+    return ok;
+}
+
+/* Обратная подстановка R X = C для верхнетреугольной R (n x n, шаг ldr),
+   C (n x nrhs) перезаписывается решением. */
+static void tri_upper_solve(const double *R, size_t n, size_t ldr, double *C, size_t nrhs) {
+    for (size_t i = n; i-- > 0;) {
+        double *ci = C + i * nrhs;
+        for (size_t p = i + 1; p < n; ++p) {
+            double r = R[i * ldr + p];
+            if (r == 0.0) continue;
+            for (size_t j = 0; j < nrhs; ++j) ci[j] -= r * C[p * nrhs + j];
+        }
+        for (size_t j = 0; j < nrhs; ++j) ci[j] /= R[i * ldr + i];
+    }
+}
+
+/* Ранг-дефицит: |r_ii| <= max(m, n) * eps * max |r_jj| */
+static int qr_rank_deficient(const double *a, size_t m, size_t n, size_t lda) {
+    size_t k = m < n ? m : n;
+    double rmax = 0.0;
+    for (size_t i = 0; i < k; ++i)
+        if (fabs(a[i * lda + i]) > rmax) rmax = fabs(a[i * lda + i]);
+    double tol = (double)(m > n ? m : n) * DBL_EPSILON * rmax;
+    for (size_t i = 0; i < k; ++i)
+        if (!(fabs(a[i * lda + i]) > tol)) return 1;
+    return 0;
+}
+
+/* Тонкое QR: A (m x n) = Q R, Q — m x k с ортонормированными столбцами,
+   R — k x n верхнетреугольная, k = min(m, n). Возвращает 1 при успехе.
+*/
+int matrix_qr(const Matrix *a, Matrix **q, Matrix **r) {
+    if (!a || !q || !r) return 0;
+    size_t m = a->rows, n = a->cols, k = m < n ? m : n;
+    Matrix *f = matrix_clone(a);
+    double *tau = malloc((k ? k : 1) * sizeof(double));
+    Matrix *Q = matrix_create(m, k);
+    Matrix *R = matrix_create(k, n);
+    if (!f || !tau || !Q || !R || !qr_factor(f->data, m, n, n, tau)) goto fail;
+    for (size_t i = 0; i < k; ++i) {
+        Q->data[i * k + i] = 1.0;
+        for (size_t j = i; j < n; ++j) R->data[i * n + j] = f->data[i * n + j];
+    }
+    if (!qr_apply_q(0, f->data, m, k, n, tau, Q->data, k, k)) goto fail;
+    matrix_free(f);
+    free(tau);
+    *q = Q;
+    *r = R;
+    return 1;
+fail:
+    matrix_free(f); free(tau); matrix_free(Q); matrix_free(R);
+    return 0;
+}
+
+/* Метод наименьших квадратов через QR, без A^T A.
+   m >= n: X = argmin ||A X - B||, X = R^-1 (Q^T B)(0:n).
+   m <  n: решение минимальной нормы через QR от A^T: A = R^T Q^T,
+           R^T Y = B, X = Q Y.
+   B — m x nrhs, результат — n x nrhs. NULL при неполном ранге.
+*/
+Matrix *matrix_lstsq(const Matrix *a, const Matrix *b) {
+    if (!a || !b || b->rows != a->rows) return NULL;
+    size_t m = a->rows, n = a->cols, nrhs = b->cols;
+    if (m >= n) {
+        Matrix *f = matrix_clone(a);
+        Matrix *c = matrix_clone(b);
+        double *tau = malloc((n ? n : 1) * sizeof(double));
+        Matrix *x = matrix_create(n, nrhs);
+        if (!f || !c || !tau || !x || !qr_factor(f->data, m, n, n, tau) ||
+            qr_rank_deficient(f->data, m, n, n) ||
+            !qr_apply_q(1, f->data, m, n, n, tau, c->data, nrhs, nrhs)) {
+            matrix_free(f); matrix_free(c); free(tau); matrix_free(x);
+            return NULL;
+        }
+        memcpy(x->data, c->data, n * nrhs * sizeof(double));
+        tri_upper_solve(f->data, n, n, x->data, nrhs);
+        matrix_free(f); matrix_free(c); free(tau);
+        return x;
+    }
+    Matrix *f = matrix_transpose(a); // n x m
+    double *tau = malloc(m * sizeof(double));
+    Matrix *x = matrix_create(n, nrhs);
+    if (!f || !tau || !x || !qr_factor(f->data, n, m, m, tau) || qr_rank_deficient(f->data, n, m, m)) {
+        matrix_free(f); free(tau); matrix_free(x);
+        return NULL;
+    }
+    // R^T Y = B: прямая подстановка, R — верхний треугольник f (m x m)
+    for (size_t i = 0; i < m; ++i) {
+        double *yi = x->data + i * nrhs;
+        memcpy(yi, b->data + i * nrhs, nrhs * sizeof(double));
+        for (size_t p = 0; p < i; ++p) {
+            double r = f->data[p * m + i];
+            for (size_t j = 0; j < nrhs; ++j) yi[j] -= r * x->data[p * nrhs + j];
+        }
+        for (size_t j = 0; j < nrhs; ++j) yi[j] /= f->data[i * m + i];
+    }
+    int ok = qr_apply_q(0, f->data, n, m, m, tau, x->data, nrhs, nrhs);
+    matrix_free(f); free(tau);
+    if (!ok) { matrix_free(x); return NULL; }
+    return x;
+}
+
+/* ====== Решение систем: LU и смешанная точность ====== */
+
+#define MIXED_MAX_ITERS 30
+
+/* Решение по множителям lu_factor: X (n x nrhs) := A^-1 X */
+static void lu_solve(const double *lu, size_t n, size_t lda, const size_t *piv, double *x, size_t nrhs) {
+    for (size_t i = 0; i < n; ++i) {
+        if (piv[i] == i) continue;
+        for (size_t j = 0; j < nrhs; ++j) {
+            double t = x[i * nrhs + j];
+            x[i * nrhs + j] = x[piv[i] * nrhs + j];
+            x[piv[i] * nrhs + j] = t;
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t p = 0; p < i; ++p) {
+            double l = lu[i * lda + p];
+            if (l == 0.0) continue;
+            for (size_t j = 0; j < nrhs; ++j) x[i * nrhs + j] -= l * x[p * nrhs + j];
+        }
+    tri_upper_solve(lu, n, lda, x, nrhs);
+}
+
+/* Решение A X = B. SPD-матрицы — через Холецкого, остальные — LU.
+   NULL, если размеры несовместимы или матрица вырождена.
+*/
+Matrix *matrix_solve(const Matrix *a, const Matrix *b) {
+    if (!a || !b || a->rows != a->cols || b->rows != a->rows) return NULL;
+    if (matrix_is_spd_candidate(a)) {
+        Matrix *x = matrix_spd_solve(a, b);
+        if (x) return x;
+    }
+    size_t n = a->rows;
+    Matrix *f = matrix_clone(a);
+    Matrix *x = matrix_clone(b);
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    if (!f || !x || !piv || !lu_factor(f->data, n, n, piv, singular_tol(a->data, n, n))) {
+        matrix_free(f); matrix_free(x); free(piv);
+        return NULL;
+    }
+    lu_solve(f->data, n, n, piv, x->data, b->cols);
+    matrix_free(f);
+    free(piv);
+    return x;
+}
+
+/* x := A^-T x для одного вектора по множителям lu_factor:
+   A^T = U^T L^T P, поэтому U^T y = x, L^T z = y, x = P^T z. */
+static void lu_solve_t(const double *lu, size_t n, size_t lda, const size_t *piv, double *x) {
+    for (size_t i = 0; i < n; ++i) {
+        double s = x[i];
+        for (size_t p = 0; p < i; ++p) s -= lu[p * lda + i] * x[p];
+        x[i] = s / lu[i * lda + i];
+    }
+    for (size_t i = n; i-- > 0;) {
+        double s = x[i];
+        for (size_t p = i + 1; p < n; ++p) s -= lu[p * lda + i] * x[p];
+        x[i] = s;
+    }
+    for (size_t i = n; i-- > 0;) {
+        double t = x[i];
+        x[i] = x[piv[i]];
+        x[piv[i]] = t;
+    }
+}
+
+#define COND_MAX_ITERS 5
+
+static double norm1_vec(const double *x, size_t n) {
+    double s = 0.0;
+    for (size_t i = 0; i < n; ++i) s += fabs(x[i]);
+    return s;
+}
+
+/* Оценка ||A^-1||_1 по множителям LU (Hager, Higham; как LAPACK dlacn2):
+   градиентный подъём по вершинам единичного шара нормы 1, по два решения
+   A^-1 x и A^-T xi на шаг, не больше COND_MAX_ITERS шагов, затем запасной
+   вектор x_i = (-1)^i (1 + i/(n-1)). O(n^2) на решение. -1 — нет памяти.
+*/
+static double lu_inv_norm1_est(const double *lu, size_t n, size_t lda, const size_t *piv) {
+    if (n == 0) return 0.0;
+    double *x = malloc(n * sizeof(double));
+    double *xi = malloc(n * sizeof(double));
+    if (!x || !xi) { free(x); free(xi); return -1.0; }
+    for (size_t i = 0; i < n; ++i) x[i] = 1.0 / (double)n;
+    lu_solve(lu, n, lda, piv, x, 1);
+    double est = norm1_vec(x, n);
+    if (n > 1) {
+        for (size_t i = 0; i < n; ++i) xi[i] = x[i] >= 0.0 ? 1.0 : -1.0;
+        memcpy(x, xi, n * sizeof(double));
+        lu_solve_t(lu, n, lda, piv, x);
+        size_t j = 0;
+        for (size_t i = 1; i < n; ++i)
+            if (fabs(x[i]) > fabs(x[j])) j = i;
+        for (int iter = 2; iter <= COND_MAX_ITERS; ++iter) {
+            memset(x, 0, n * sizeof(double));
+            x[j] = 1.0;
+            lu_solve(lu, n, lda, piv, x, 1);
+            double old = est;
+            est = norm1_vec(x, n);
+            int same = 1;
+            for (size_t i = 0; i < n && same; ++i) same = (x[i] >= 0.0 ? 1.0 : -1.0) == xi[i];
+            if (same || est <= old) { if (est < old) est = old; break; }
+            for (size_t i = 0; i < n; ++i) xi[i] = x[i] >= 0.0 ? 1.0 : -1.0;
+            memcpy(x, xi, n * sizeof(double));
+            lu_solve_t(lu, n, lda, piv, x);
+            size_t jlast = j;
+            for (size_t i = 0; i < n; ++i)
+                if (fabs(x[i]) > fabs(x[j])) j = i;
+            if (fabs(x[jlast]) == fabs(x[j])) break; // новая вершина не лучше
+        }
+        // запасной вектор с чередующимися знаками ловит случаи, где подъём застревает
+        for (size_t i = 0; i < n; ++i)
+            x[i] = (i % 2 ? -1.0 : 1.0) * (1.0 + (double)i / (double)(n - 1));
+        lu_solve(lu, n, lda, piv, x, 1);
+        double alt = 2.0 * norm1_vec(x, n) / (3.0 * (double)n);
+        if (alt > est) est = alt;
+    }
+    free(x);
+    free(xi);
+    return est;
+}
+
+/* Обратная оценка числа обусловленности 1 / (||A||_1 * est ||A^-1||_1)
+   по уже готовым множителям; anorm = ||A||_1 исходной матрицы. */
+static double lu_rcond(const double *lu, size_t n, size_t lda, const size_t *piv, double anorm) {
+    if (n == 0) return 1.0;
+    double inv = lu_inv_norm1_est(lu, n, lda, piv);
+    if (inv < 0.0) return -1.0;
+    if (anorm == 0.0 || inv == 0.0 || !isfinite(inv)) return 0.0;
+    return (1.0 / anorm) / inv;
+}
+
+/* Оценка 1 / cond_1(A) за O(n^2) сверх одного LU (Hager–Higham):
+   около 1 — хорошо обусловлена, меньше n * eps — результату обращения
+   доверять нельзя. 0 — вырождена, -1 — не квадратная или нет памяти.
+*/
+double matrix_rcond(const Matrix *a) {
+    if (!a || a->rows != a->cols) return -1.0;
+    size_t n = a->rows;
+    Matrix *f = matrix_clone(a);
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    double r = -1.0;
+    if (f && piv) {
+        if (lu_factor(f->data, n, n, piv, 0.0)) r = lu_rcond(f->data, n, n, piv, matrix_norm(a, '1'));
+        else r = 0.0;
+    }
+    matrix_free(f);
+    free(piv);
+    return r;
+}
+
+/* Обратная матрица вместе с оценкой rcond по тем же множителям LU
+   (без второго разложения). При вырожденности — NULL и *rcond = 0.
+*/
+Matrix *matrix_inverse_cond(const Matrix *a, double *rcond) {
+    if (rcond) *rcond = -1.0;
+    if (!a || a->rows != a->cols) return NULL;
+    size_t n = a->rows;
+    Matrix *inv = matrix_clone(a);
+    size_t *piv = malloc((n ? n : 1) * sizeof(size_t));
+    if (!inv || !piv) { matrix_free(inv); free(piv); return NULL; }
+    if (!lu_factor(inv->data, n, n, piv, singular_tol(a->data, n, n))) {
+        if (rcond) *rcond = 0.0;
+        matrix_free(inv);
+        free(piv);
+        return NULL;
+    }
+    if (rcond) *rcond = lu_rcond(inv->data, n, n, piv, matrix_norm(a, '1'));
+    if (!lu_inverse_inplace(inv->data, n, n, piv)) {
+        matrix_free(inv);
+        inv = NULL;
+    }
+    free(piv);
+    return inv;
+}
+
+/* LU с частичным выбором опорного элемента в одинарной точности.
+   Возвращает 0 при нулевом или не конечном опорном элементе.
+*/
+static int lu_factor_f(float *a, size_t n, size_t *piv) {
+    for (size_t i = 0; i < n; ++i) {
+        size_t p = i;
+        for (size_t r = i + 1; r < n; ++r)
+            if (fabsf(a[r * n + i]) > fabsf(a[p * n + i])) p = r;
+        piv[i] = p;
+        if (a[p * n + i] == 0.0f || !isfinite(a[p * n + i])) return 0;
+        if (p != i)
+            for (size_t c = 0; c < n; ++c) {
+                float t = a[i * n + c];
+                a[i * n + c] = a[p * n + c];
+                a[p * n + c] = t;
+            }
+        float pivot = a[i * n + i];
+        for (size_t r = i + 1; r < n; ++r) {
+            float factor = a[r * n + i] / pivot;
+            a[r * n + i] = factor;
+            float *ar = a + r * n, *ai = a + i * n;
+            for (size_t c = i + 1; c < n; ++c) ar[c] -= factor * ai[c];
+        }
+    }
+    return 1;
+}
+
+static void lu_solve_f(const float *lu, size_t n, const size_t *piv, float *x, size_t nrhs) {
+    for (size_t i = 0; i < n; ++i) {
+        if (piv[i] == i) continue;
+        for (size_t j = 0; j < nrhs; ++j) {
+            float t = x[i * nrhs + j];
+            x[i * nrhs + j] = x[piv[i] * nrhs + j];
+            x[piv[i] * nrhs + j] = t;
+        }
+    }
+    for (size_t i = 0; i < n; ++i)
+        for (size_t p = 0; p < i; ++p) {
+            float l = lu[i * n + p];
+            for (size_t j = 0; j < nrhs; ++j) x[i * nrhs + j] -= l * x[p * nrhs + j];
+        }
+    for (size_t i = n; i-- > 0;) {
+        for (size_t p = i + 1; p < n; ++p) {
+            float u = lu[i * n + p];
+            for (size_t j = 0; j < nrhs; ++j) x[i * nrhs + j] -= u * x[p * nrhs + j];
+        }
+        for (size_t j = 0; j < nrhs; ++j) x[i * nrhs + j] /= lu[i * n + i];
+    }
+}
+
+/* Решение A X = B со смешанной точностью (как LAPACK dsgesv):
+   LU считается во float (вдвое шире SIMD, вдвое меньше трафика), затем
+   итерационное уточнение: невязка R = B - A X в double через matrix_gemm,
+   поправка — решением во float. Сходимость: для каждого столбца
+   max|r| <= max|x| * ||A||_inf * eps * sqrt(n).
+   *iters — число итераций уточнения; -1, если пришлось перейти на
+   double LU (A не помещается во float, LU во float не удался или
+   уточнение не сошлось за MIXED_MAX_ITERS — признак плохой обусловленности).
+*/
+Matrix *matrix_solve_mixed(const Matrix *a, const Matrix *b, int *iters) {
+    if (iters) *iters = -1;
+    if (!a || !b || a->rows != a->cols || b->rows != a->rows) return NULL;
+    size_t n = a->rows, nrhs = b->cols;
+    float *af = malloc((n ? n * n : 1) * sizeof(float));
+    size_t nb = n * nrhs;
+    float *cf = malloc((nb ? nb : 1) * sizeof(float));
+    size_t *piv = calloc(n ? n : 1, sizeof(size_t));
+    Matrix *x = matrix_create(n, nrhs);
+    Matrix *r = matrix_create(n, nrhs);
+    int ok = af && cf && piv && x && r;
+    double anrm = 0.0;
+    for (size_t i = 0; ok && i < n; ++i) {
+        double s = 0.0;
+        for (size_t j = 0; j < n; ++j) {
+            double v = a->data[i * n + j];
+            if (fabs(v) > FLT_MAX) ok = 0;
+            af[i * n + j] = (float)v;
+            s += fabs(v);
+        }
+        if (s > anrm) anrm = s;
+    }
+    for (size_t i = 0; ok && i < n * nrhs; ++i) {
+        if (fabs(b->data[i]) > FLT_MAX) ok = 0;
+        cf[i] = (float)b->data[i];
+    }
+    if (ok) ok = lu_factor_f(af, n, piv);
+    int converged = 0, it = 0;
+    if (ok) {
+        lu_solve_f(af, n, piv, cf, nrhs);
+        for (size_t i = 0; i < n * nrhs; ++i) x->data[i] = cf[i];
+        double cte = anrm * DBL_EPSILON * sqrt((double)n);
+        for (it = 0; it <= MIXED_MAX_ITERS; ++it) {
+            memcpy(r->data, b->data, n * nrhs * sizeof(double));
+            matrix_gemm(0, 0, n, nrhs, n, -1.0, a->data, n, x->data, nrhs, 1.0, r->data, nrhs);
+            converged = 1;
+            for (size_t j = 0; j < nrhs && converged; ++j) {
+                double xmax = 0.0, rmax = 0.0;
+                for (size_t i = 0; i < n; ++i) {
+                    if (fabs(x->data[i * nrhs + j]) > xmax) xmax = fabs(x->data[i * nrhs + j]);
+                    if (fabs(r->data[i * nrhs + j]) > rmax) rmax = fabs(r->data[i * nrhs + j]);
+                }
+                if (!(rmax <= xmax * cte)) converged = 0;
+            }
+            if (converged || it == MIXED_MAX_ITERS) break;
+            for (size_t i = 0; i < n * nrhs; ++i) cf[i] = (float)r->data[i];
+            lu_solve_f(af, n, piv, cf, nrhs);
+            for (size_t i = 0; i < n * nrhs; ++i) x->data[i] += cf[i];
+        }
+    }
+    free(af); free(cf); free(piv); matrix_free(r);
+    if (converged) {
+        if (iters) *iters = it;
+        return x;
+    }
+    matrix_free(x);
+    return matrix_solve(a, b);
+}
+
+/* ====== Симметричная задача на собственные значения ====== */
+
+#define TRD_NB 32
+#define DC_SMALL 25
+
+/* y = A v для симметричной A (len x len), хранится нижний треугольник */
+static void symv_lower(const double *a, size_t len, size_t lda, const double *v, double *y) {
+    for (size_t r = 0; r < len; ++r) y[r] = 0.0;
+    for (size_t r = 0; r < len; ++r) {
+        const double *ar = a + r * lda;
+        double s = 0.0, vr = v[r];
+        for (size_t c = 0; c < r; ++c) {
+            s += ar[c] * v[c];
+            y[c] += ar[c] * vr;
+        }
+        y[r] += s + ar[r] * vr;
+    }
+}
+
+/* Блочная трёхдиагонализация A = Q T Q^T (используется нижний треугольник).
+   Как в dsytrd/dlatrd: внутри панели из TRD_NB столбцов отражения строятся
+   по одному с отложенным обновлением (матрица W), затем хвост обновляется
+   двумя GEMM: A22 -= V W^T + W V^T, только на и под диагональю.
+   d — диагональ T, e — поддиагональ; отражение i хранится в A(i+2:n, i)
+   с неявной единицей в (i+1, i), tau[i] — его коэффициент.
+*/
+static int sym_tridiagonalize(double *a, size_t n, size_t lda, double *d, double *e, double *tau) {
+    if (n == 0) return 1;
+    double *W = malloc(n * TRD_NB * sizeof(double));
+    double *v = malloc(n * sizeof(double));
+    double *y = malloc(n * sizeof(double));
+    if (!W || !v || !y) { free(W); free(v); free(y); return 0; }
+    double t1[TRD_NB], t2[TRD_NB];
+    for (size_t j0 = 0; j0 + 1 < n; j0 += TRD_NB) {
+        size_t nb = (n - 1 - j0 < TRD_NB) ? n - 1 - j0 : TRD_NB;
+        for (size_t p = 0; p < nb; ++p) {
+            size_t i = j0 + p;
+            // отложенное обновление столбца i: A(i:n, i) -= V W(i,:)^T + W V(i,:)^T
+            for (size_t r = i; r < n; ++r) {
+                double s = 0.0;
+                for (size_t q = 0; q < p; ++q)
+                    s += a[r * lda + j0 + q] * W[i * TRD_NB + q] + W[r * TRD_NB + q] * a[i * lda + j0 + q];
+                a[r * lda + i] -= s;
+            }
+            d[i] = a[i * lda + i];
+            householder(a + (i + 1) * lda + i, n - i - 1, lda, &tau[i]);
+            e[i] = a[(i + 1) * lda + i];
+            a[(i + 1) * lda + i] = 1.0;
+            // W(i+1:n, p) = tau (A22 v - V (W^T v) - W (V^T v)) + alpha v
+            size_t len = n - i - 1;
+            for (size_t r = 0; r < len; ++r) v[r] = a[(i + 1 + r) * lda + i];
+            symv_lower(a + (i + 1) * lda + i + 1, len, lda, v, y);
+            for (size_t q = 0; q < p; ++q) {
+                double s1 = 0.0, s2 = 0.0;
+                for (size_t r = 0; r < len; ++r) {
+                    s1 += W[(i + 1 + r) * TRD_NB + q] * v[r];
+                    s2 += a[(i + 1 + r) * lda + j0 + q] * v[r];
+                }
+                t1[q] = s1;
+                t2[q] = s2;
+            }
+            double dot = 0.0;
+            for (size_t r = 0; r < len; ++r) {
+                double s = y[r];
+                for (size_t q = 0; q < p; ++q)
+                    s -= a[(i + 1 + r) * lda + j0 + q] * t1[q] + W[(i + 1 + r) * TRD_NB + q] * t2[q];
+                y[r] = tau[i] * s;
+                dot += y[r] * v[r];
+            }
+            double alpha = -0.5 * tau[i] * dot;
+            for (size_t r = 0; r < len; ++r) W[(i + 1 + r) * TRD_NB + p] = y[r] + alpha * v[r];
+        }
+        size_t s0 = j0 + nb;
+        for (size_t ib = s0; ib < n; ib += TRD_NB) {
+            size_t rb = (n - ib < TRD_NB) ? n - ib : TRD_NB;
+            size_t nc = ib + rb - s0;
+            matrix_gemm(0, 1, rb, nc, nb, -1.0, a + ib * lda + j0, lda, W + s0 * TRD_NB, TRD_NB,
+                        1.0, a + ib * lda + s0, lda);
+            matrix_gemm(0, 1, rb, nc, nb, -1.0, W + ib * TRD_NB, TRD_NB, a + s0 * lda + j0, lda,
+                        1.0, a + ib * lda + s0, lda);
+        }
+        for (size_t p = 0; p < nb; ++p) a[(j0 + p + 1) * lda + j0 + p] = e[j0 + p];
+    }
+    d[n - 1] = a[(n - 1) * lda + n - 1];
+    free(W); free(v); free(y);
+    return 1;
+}
+
+/* Неявный QL со сдвигом Уилкинсона для трёхдиагональной матрицы.
+   e[0..n-2] — поддиагональ (портится, нужна длина n). Если q != NULL,
+   вращения накапливаются в столбцах q (qrows x n, шаг ldq).
+*/
+static int tql_implicit(double *d, double *e, size_t n, double *q, size_t qrows, size_t ldq) {
+    if (n == 0) return 1;
+    e[n - 1] = 0.0;
+    for (size_t l = 0; l < n; ++l) {
+        int iter = 0;
+        size_t m;
+        do {
+            for (m = l; m + 1 < n; ++m) {
+                double dd = fabs(d[m]) + fabs(d[m + 1]);
+                if (fabs(e[m]) <= DBL_EPSILON * dd) break;
+            }
+            if (m != l) {
+                if (iter++ == 60) return 0;
+                double g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+                double r = hypot(g, 1.0);
+                g = d[m] - d[l] + e[l] / (g + copysign(r, g));
+                double s = 1.0, c = 1.0, p = 0.0;
+                ptrdiff_t i;
+                for (i = (ptrdiff_t)m - 1; i >= (ptrdiff_t)l; --i) {
+                    double f = s * e[i], b = c * e[i];
+                    e[i + 1] = (r = hypot(f, g));
+                    if (r == 0.0) {
+                        d[i + 1] -= p;
+                        e[m] = 0.0;
+                        break;
+                    }
+                    s = f / r;
+                    c = g / r;
+                    g = d[i + 1] - p;
+                    r = (d[i] - g) * s + 2.0 * c * b;
+                    d[i + 1] = g + (p = s * r);
+                    g = c * r - b;
+                    if (q) {
+                        for (size_t k = 0; k < qrows; ++k) {
+                            double fk = q[k * ldq + i + 1];
+                            q[k * ldq + i + 1] = s * q[k * ldq + i] + c * fk;
+                            q[k * ldq + i] = c * q[k * ldq + i] - s * fk;
+                        }
+                    }
+                }
+                if (r == 0.0 && i >= (ptrdiff_t)l) continue;
+                d[l] -= p;
+                e[l] = g;
+                e[m] = 0.0;
+            }
+        } while (m != l);
+    }
+    return 1;
+}
+
+typedef struct {
+    double val;
+    size_t idx;
+} EigPair;
+
+static int eigpair_cmp(const void *x, const void *y) {
+    double a = ((const EigPair *)x)->val, b = ((const EigPair *)y)->val;
+    return (a > b) - (a < b);
+}
+
+static int double_cmp(const void *x, const void *y) {
+    double a = *(const double *)x, b = *(const double *)y;
+    return (a > b) - (a < b);
+}
+
+/* Сортировка собственных пар по возрастанию (столбцы q переставляются) */
+static int eig_sort(double *d, size_t n, double *q, size_t ldq) {
+    EigPair *ps = malloc((n ? n : 1) * sizeof(EigPair));
+    double *tmp = malloc((n ? n * n : 1) * sizeof(double));
+    if (!ps || !tmp) { free(ps); free(tmp); return 0; }
+    for (size_t i = 0; i < n; ++i) { ps[i].val = d[i]; ps[i].idx = i; }
+    qsort(ps, n, sizeof(EigPair), eigpair_cmp);
+    for (size_t r = 0; r < n; ++r)
+        for (size_t c = 0; c < n; ++c) tmp[r * n + c] = q[r * ldq + ps[c].idx];
+    for (size_t r = 0; r < n; ++r) memcpy(q + r * ldq, tmp + r * n, n * sizeof(double));
+    for (size_t i = 0; i < n; ++i) d[i] = ps[i].val;
+    free(ps); free(tmp);
+    return 1;
+}
+
+/* Корень k секулярного уравнения f(x) = 1 + rho sum z_j^2 / (d_j - x) = 0
+   (d по возрастанию, rho > 0). Корень ищется как x = d[o] + tau относительно
+   ближайшего полюса o (выбирается по знаку f в середине интервала): разности
+   d_j - x = (d_j - d_o) - tau тогда считаются без потери точности. Шаг —
+   по рациональной модели с двумя полюсами (d_k, d_{k+1}), с защитой
+   бисекцией внутри текущего интервала.
+*/
+static double secular_root(const double *dd, const double *zz, size_t K, double rho,
+                           size_t k, size_t *origin) {
+    size_t o;
+    double lo, hi;
+    if (k + 1 < K) {
+        double mid = 0.5 * (dd[k + 1] - dd[k]);
+        double f = 1.0;
+        for (size_t j = 0; j < K; ++j) f += rho * zz[j] * zz[j] / ((dd[j] - dd[k]) - mid);
+        if (f >= 0.0) { o = k; lo = 0.0; hi = mid; }
+        else { o = k + 1; lo = -mid; hi = 0.0; }
+    } else {
+        double zsq = 0.0;
+        for (size_t j = 0; j < K; ++j) zsq += zz[j] * zz[j];
+        o = K - 1;
+        lo = 0.0;
+        hi = rho * zsq;
+    }
+    *origin = o;
+    double tau = 0.5 * (lo + hi);
+    for (int iter = 0; iter < 100; ++iter) {
+        double psi = 0.0, dpsi = 0.0, phi = 0.0, dphi = 0.0;
+        for (size_t j = 0; j <= k; ++j) {
+            double t = zz[j] / ((dd[j] - dd[o]) - tau);
+            psi += zz[j] * t;
+            dpsi += t * t;
+        }
+        for (size_t j = k + 1; j < K; ++j) {
+            double t = zz[j] / ((dd[j] - dd[o]) - tau);
+            phi += zz[j] * t;
+            dphi += t * t;
+        }
+        psi *= rho; dpsi *= rho; phi *= rho; dphi *= rho;
+        double f = 1.0 + psi + phi;
+        if (f == 0.0 || fabs(f) <= 8.0 * DBL_EPSILON * (double)K * (1.0 + fabs(psi) + fabs(phi))) break;
+        if (f > 0.0) hi = tau; else lo = tau;
+        if (hi - lo <= 2.0 * DBL_EPSILON * fmax(fabs(lo), fabs(hi))) break;
+        double dk = (dd[k] - dd[o]) - tau;
+        double eta;
+        if (k + 1 < K) {
+            double dk1 = (dd[k + 1] - dd[o]) - tau;
+            double c = f - dk * dpsi - dk1 * dphi;
+            double s = dk * dk * dpsi, S = dk1 * dk1 * dphi;
+            double qa = c, qb = -(c * (dk + dk1) + s + S), qc = c * dk * dk1 + s * dk1 + S * dk;
+            eta = NAN;
+            if (fabs(qa) <= DBL_EPSILON * (fabs(qb) + fabs(qc))) {
+                if (qb != 0.0) eta = -qc / qb;
+            } else {
+                double disc = qb * qb - 4.0 * qa * qc;
+                double qq = -0.5 * (qb + copysign(sqrt(disc > 0.0 ? disc : 0.0), qb));
+                double r1 = qq / qa, r2 = (qq != 0.0) ? qc / qq : NAN;
+                eta = (r1 > dk && r1 < dk1) ? r1 : r2;
+            }
+        } else {
+            double c = f - dk * dpsi;
+            double s = dk * dk * dpsi;
+            eta = (c != 0.0) ? dk + s / c : NAN;
+        }
+        double next = tau + eta;
+        if (!(next > lo && next < hi)) next = 0.5 * (lo + hi);
+        tau = next;
+    }
+    return tau;
+}
+
+/* Слияние в методе "разделяй и властвуй": собственная задача для
+   D + r z z^T, где D — объединённые собственные значения половин.
+   Дефляция: малые компоненты z и близкие d (вращение Гивенса).
+   Векторы недефлированной части по Гу-Айзенштату (z пересчитывается по
+   найденным корням, что сохраняет ортогональность) и умножаются на
+   собственные векторы половин одним GEMM.
+*/
+static int dc_merge(double *d, size_t n, size_t m, double rho, double *Q, size_t ldq) {
+    const size_t NONE = (size_t)-1;
+    double *z = malloc(n * sizeof(double));
+    EigPair *order = malloc(n * sizeof(EigPair));
+    size_t *nd = malloc(n * sizeof(size_t));
+    EigPair *all = malloc(n * sizeof(EigPair));
+    double *dd = malloc(n * sizeof(double)), *zz = malloc(n * sizeof(double));
+    double *tau = malloc(n * sizeof(double)), *zhat = malloc(n * sizeof(double));
+    size_t *orig = malloc(n * sizeof(size_t));
+    double *U = NULL, *G = NULL, *R = NULL, *out = NULL;
+    int ok = 0;
+    if (!z || !order || !nd || !all || !dd || !zz || !tau || !zhat || !orig) goto done;
+
+    double sgn = rho < 0.0 ? -1.0 : 1.0;
+    for (size_t c = 0; c < n; ++c)
+        z[c] = (c < m ? Q[(m - 1) * ldq + c] : sgn * Q[m * ldq + c]) / sqrt(2.0);
+    double r = 2.0 * fabs(rho);
+    double dmax = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        order[i].val = d[i];
+        order[i].idx = i;
+        if (fabs(d[i]) > dmax) dmax = fabs(d[i]);
+    }
+    qsort(order, n, sizeof(EigPair), eigpair_cmp);
+    double tol = 8.0 * DBL_EPSILON * fmax(dmax, r);
+
+    size_t K = 0, nall = 0, prev = NONE;
+    for (size_t t = 0; t < n; ++t) {
+        size_t j = order[t].idx;
+        if (r * fabs(z[j]) <= tol) { // z_j мал: пара (d_j, q_j) уже собственная
+            all[nall].val = d[j];
+            all[nall++].idx = j;
+            continue;
+        }
+        if (prev != NONE) {
+            double h = hypot(z[prev], z[j]);
+            double c = z[j] / h, s = z[prev] / h;
+            if (fabs(c * s * (d[j] - d[prev])) <= tol) {
+                // близкие d: вращение обнуляет z_prev
+                for (size_t row = 0; row < n; ++row) {
+                    double qp = Q[row * ldq + prev], qj = Q[row * ldq + j];
+                    Q[row * ldq + prev] = c * qp - s * qj;
+                    Q[row * ldq + j] = s * qp + c * qj;
+                }
+                double dp = c * c * d[prev] + s * s * d[j];
+                double dj = s * s * d[prev] + c * c * d[j];
+                d[prev] = dp;
+                d[j] = dj;
+                z[j] = h;
+                z[prev] = 0.0;
+                all[nall].val = dp;
+                all[nall++].idx = prev;
+                prev = j;
+                continue;
+            }
+            nd[K++] = prev;
+        }
+        prev = j;
+    }
+    if (prev != NONE) nd[K++] = prev;
+
+    if (K > 0) {
+        U = malloc(K * K * sizeof(double));
+        G = malloc(n * K * sizeof(double));
+        R = malloc(n * K * sizeof(double));
+        if (!U || !G || !R) goto done;
+        for (size_t k = 0; k < K; ++k) { dd[k] = d[nd[k]]; zz[k] = z[nd[k]]; }
+        for (size_t k = 0; k < K; ++k) tau[k] = secular_root(dd, zz, K, r, k, &orig[k]);
+        // d_i - lambda_k = (dd_i - dd_o) - tau_k
+#define DC_DELTA(i, k) ((dd[i] - dd[orig[k]]) - tau[k])
+        for (size_t i = 0; i < K; ++i) {
+            double w = -DC_DELTA(i, i);
+            for (size_t j = 0; j < K; ++j)
+                if (j != i) w *= -DC_DELTA(i, j) / (dd[j] - dd[i]);
+            zhat[i] = copysign(sqrt(fabs(w) / r), zz[i]);
+        }
+        for (size_t k = 0; k < K; ++k) {
+            double nrm = 0.0;
+            for (size_t i = 0; i < K; ++i) {
+                double u = zhat[i] / DC_DELTA(i, k);
+                U[i * K + k] = u;
+                nrm += u * u;
+            }
+            nrm = 1.0 / sqrt(nrm);
+            for (size_t i = 0; i < K; ++i) U[i * K + k] *= nrm;
+        }
+#undef DC_DELTA
+        for (size_t row = 0; row < n; ++row)
+            for (size_t k = 0; k < K; ++k) G[row * K + k] = Q[row * ldq + nd[k]];
+        matrix_gemm(0, 0, n, K, K, 1.0, G, K, U, K, 0.0, R, K);
+        for (size_t k = 0; k < K; ++k) {
+            all[nall].val = dd[orig[k]] + tau[k];
+            all[nall++].idx = n + k; // столбец k из R
+        }
+    }
+    out = malloc(n * n * sizeof(double));
+    if (!out) goto done;
+    qsort(all, n, sizeof(EigPair), eigpair_cmp);
+    for (size_t c = 0; c < n; ++c) {
+        size_t src = all[c].idx;
+        for (size_t row = 0; row < n; ++row)
+            out[row * n + c] = (src < n) ? Q[row * ldq + src] : R[row * K + (src - n)];
+        d[c] = all[c].val;
+    }
+    for (size_t row = 0; row < n; ++row) memcpy(Q + row * ldq, out + row * n, n * sizeof(double));
+    ok = 1;
+done:
+    free(z); free(order); free(nd); free(all); free(dd); free(zz); free(tau);
+    free(zhat); free(orig); free(U); free(G); free(R); free(out);
+    return ok;
+}
+
+/* Собственные пары трёхдиагональной матрицы (d, e) методом
+   "разделяй и властвуй" (Cuppen): T = diag(T1, T2) + |rho| v v^T,
+   половины решаются рекурсивно, маленькие блоки — неявным QL.
+   Q (n x n, шаг ldq) получает собственные векторы по столбцам.
+*/
+static int tridiag_dc(double *d, const double *e, size_t n, double *Q, size_t ldq) {
+    if (n <= DC_SMALL) {
+        double ee[DC_SMALL];
+        for (size_t i = 0; i + 1 < n; ++i) ee[i] = e[i];
+        for (size_t r = 0; r < n; ++r)
+            for (size_t c = 0; c < n; ++c) Q[r * ldq + c] = (r == c) ? 1.0 : 0.0;
+        return tql_implicit(d, ee, n, Q, n, ldq) && eig_sort(d, n, Q, ldq);
+    }
+    size_t m = n / 2;
+    double rho = e[m - 1];
+    d[m - 1] -= fabs(rho);
+    d[m] -= fabs(rho);
+    if (!tridiag_dc(d, e, m, Q, ldq) || !tridiag_dc(d + m, e + m, n - m, Q + m * ldq + m, ldq))
+        return 0;
+    for (size_t r = 0; r < n; ++r)
+        for (size_t c = 0; c < n; ++c)
+            if ((r < m) != (c < m)) Q[r * ldq + c] = 0.0;
+    return dc_merge(d, n, m, rho, Q, ldq);
+}
+
+/* Собственные значения симметричной матрицы (по возрастанию в w, длина n)
+   и, если vectors != NULL, ортонормированные собственные векторы по столбцам.
+   Используется нижний треугольник a. Без векторов трёхдиагональная
+   задача решается неявным QL без накопления вращений.
+   Возвращает 1 при успехе.
+*/
+int matrix_eigen_sym(const Matrix *a, double *w, Matrix **vectors) {
+    if (!a || !w || a->rows != a->cols) return 0;
+    size_t n = a->rows;
+    Matrix *f = matrix_clone(a);
+    double *e = malloc((n ? n : 1) * sizeof(double));
+    double *tau = malloc((n ? n : 1) * sizeof(double));
+    Matrix *Z = NULL;
+    int ok = f && e && tau && sym_tridiagonalize(f->data, n, n, w, e, tau);
+    if (ok && !vectors) {
+        ok = tql_implicit(w, e, n, NULL, 0, 0);
+        if (ok) qsort(w, n, sizeof(double), double_cmp);
+    } else if (ok) {
+        Z = matrix_create(n, n);
+        ok = Z && tridiag_dc(w, e, n, Z->data, n);
+        // Z := Q Z, Q = diag(1, H_0 ... H_{n-2})
+        if (ok && n > 1)
+            ok = qr_apply_q(0, f->data + n, n - 1, n - 1, n, tau, Z->data + n, n, n);
+    }
+    matrix_free(f);
+    free(e);
+    free(tau);
+    if (!ok) { matrix_free(Z); return 0; }
+    if (vectors) *vectors = Z;
+    return 1;
+}
+
+/* ====== Степень матрицы ====== */
+
+/* A^k возведением в квадрат: ~log2(k) + popcount(k) умножений. Три буфера
+   n x n (результат, степень A^(2^i), рабочий) и буфер упаковки GEMM
+   выделяются до цикла, после каждого умножения меняются местами указатели
+   данных — в цикле нет ни одного выделения памяти. Сокращения:
+   - диагональная A: поэлементно pow(a_ii, k);
+   - симметричная A (n > SMALL_N_MAX), если умножений больше, чем стоит
+     разложение (~9 n^3 против 2 n^3 на умножение): A^k = V diag(l^k) V^T
+     через matrix_eigen_sym. Результат тогда точен до округления, но не
+     побитово равен повторному умножению.
+   k < 0 — степень обратной матрицы; NULL, если A не квадратная или
+   вырождена (при k < 0), а также при нехватке памяти.
+*/
+#define POWER_EIG_MULTS 5 // с этого числа умножений симметричные — через спектр
+
+static int is_diagonal(const Matrix *a) {
+    size_t n = a->rows;
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < n; ++j)
+            if (i != j && a->data[i * n + j] != 0.0) return 0;
+    return 1;
+}
+
+static int is_symmetric(const Matrix *a) {
+    size_t n = a->rows;
+    for (size_t i = 0; i < n; ++i)
+        for (size_t j = 0; j < i; ++j)
+            if (a->data[i * n + j] != a->data[j * n + i]) return 0;
+    return 1;
+}
+
+/* C = A B для n x n (малые — развёрнутым ядром); pb — буфер упаковки
+   gemm_pack_len(n, n) или NULL (тогда matrix_gemm выделит свой) */
+static void square_mul(size_t n, const double *a, const double *b, double *c, double *pb) {
+    if (n <= SMALL_N_MAX) small_kernels[n].mul(a, b, c);
+    else if (pb) gemm_packed(0, 0, n, n, n, 1.0, a, n, b, n, 0.0, c, n, pb);
+    else matrix_gemm(0, 0, n, n, n, 1.0, a, n, b, n, 0.0, c, n);
+}
+
+static Matrix *power_eigen(const Matrix *a, unsigned long k) {
+    size_t n = a->rows;
+    double *w = malloc(n * sizeof(double));
+    Matrix *V = NULL, *W = NULL, *R = NULL;
+    if (w && matrix_eigen_sym(a, w, &V) && (W = matrix_clone(V)) && (R = matrix_create(n, n))) {
+        // W = V diag(l^k), R = W V^T
+        for (size_t i = 0; i < n; ++i)
+            for (size_t j = 0; j < n; ++j) W->data[i * n + j] *= pow(w[j], (double)k);
+        matrix_gemm(0, 1, n, n, n, 1.0, W->data, n, V->data, n, 0.0, R->data, n);
+    } else {
+        matrix_free(R);
+        R = NULL;
+    }
+    free(w);
+    matrix_free(V);
+    matrix_free(W);
+    return R;
+}
+
+Matrix *matrix_power(const Matrix *a, long k) {
+    if (!a || a->rows != a->cols) return NULL;
+    size_t n = a->rows;
+    if (k < 0) {
+        Matrix *inv = matrix_inverse(a);
+        if (!inv) return NULL;
+        // -(k + 1) + 1 — без переполнения при LONG_MIN
+        Matrix *r = matrix_power(inv, -(k + 1));
+        if (r && n > 0) {
+            Matrix *t = matrix_create(n, n);
+            if (t) square_mul(n, r->data, inv->data, t->data, NULL);
+            matrix_free(r);
+            r = t;
+        }
+        matrix_free(inv);
+        return r;
+    }
+    unsigned long e = (unsigned long)k;
+    Matrix *R = matrix_create(n, n);
+    if (!R || n == 0) return R;
+    if (is_diagonal(a)) {
+        for (size_t i = 0; i < n; ++i) R->data[i * n + i] = pow(a->data[i * n + i], (double)e);
+        return R;
+    }
+    unsigned mults = 0;
+    for (unsigned long b = e; b > 1; b >>= 1) mults += 1 + (unsigned)(b & 1);
+    if (n > SMALL_N_MAX && mults >= POWER_EIG_MULTS && is_symmetric(a)) {
+        Matrix *r = power_eigen(a, e);
+        if (r) { matrix_free(R); return r; }
+    }
+    Matrix *B = matrix_clone(a), *T = matrix_create(n, n);
+    double *pb = n > SMALL_N_MAX ? malloc(gemm_pack_len(n, n) * sizeof(double)) : NULL;
+    if (!B || !T || (n > SMALL_N_MAX && !pb)) {
+        matrix_free(R); matrix_free(B); matrix_free(T); free(pb);
+        return NULL;
+    }
+    int have = 0; // R ещё не инициализирован (вместо умножения на I)
+    for (;;) {
+        if (e & 1) {
+            if (!have) memcpy(R->data, B->data, n * n * sizeof(double));
+            else {
+                square_mul(n, R->data, B->data, T->data, pb);
+                double *t = R->data; R->data = T->data; T->data = t;
+            }
+            have = 1;
+        }
+        e >>= 1;
+        if (!e) break;
+        square_mul(n, B->data, B->data, T->data, pb);
+        double *t = B->data; B->data = T->data; T->data = t;
+    }
+    if (!have) // k = 0
+        for (size_t i = 0; i < n; ++i) R->data[i * n + i] = 1.0;
+    matrix_free(B);
+    matrix_free(T);
+    free(pb);
+    return R;
+}
+
+/* ====== Матричная экспонента ====== */
+
+/* exp(A) масштабированием и возведением в квадрат с аппроксимантой Паде
+   (Higham, 2005): по ||A||_1 выбирается наименьшая степень m из 3, 5, 7, 9,
+   для которой ошибка аппроксиманты не больше eps (порог theta_m); иначе
+   A делится на 2^s так, чтобы ||A / 2^s||_1 <= theta_13, берётся [13/13] и
+   результат s раз возводится в квадрат. Многочлены считаются по схеме,
+   минимизирующей число умножений: для m = 13 — 6 GEMM (A^2, A^4, A^6 и
+   три внешних), затем одно решение (V - U) X = V + U через LU.
+*/
+static const double expm_theta[5] = {
+    1.495585217958292e-2, 2.539398330063230e-1, 9.504178996162932e-1,
+    2.097847961257068e0, 5.371920351148152e0
+};
+
+static const double expm_b3[4] = { 120.0, 60.0, 12.0, 1.0 };
+static const double expm_b5[6] = { 30240.0, 15120.0, 3360.0, 420.0, 30.0, 1.0 };
+static const double expm_b7[8] = { 17297280.0, 8648640.0, 1995840.0, 277200.0, 25200.0, 1512.0, 56.0, 1.0 };
+static const double expm_b9[10] = { 17643225600.0, 8821612800.0, 2075673600.0, 302702400.0, 30270240.0,
+                                    2162160.0, 110880.0, 3960.0, 90.0, 1.0 };
+static const double expm_b13[14] = { 64764752532480000.0, 32382376266240000.0, 7771770303897600.0,
+                                     1187353796428800.0, 129060195264000.0, 10559470521600.0,
+                                     670442572800.0, 33522128640.0, 1323241920.0, 40840800.0,
+                                     960960.0, 16380.0, 182.0, 1.0 };
+
+/* C = A B, n x n, с общим буфером упаковки pb */
+static void expm_mul(size_t n, const double *a, const double *b, double *c, double *pb) {
+    gemm_packed(0, 0, n, n, n, 1.0, a, n, b, n, 0.0, c, n, pb);
+}
+
+Matrix *matrix_expm(const Matrix *a) {
+    if (!a || a->rows != a->cols) return NULL;
+    size_t n = a->rows, nn = n * n;
+    double norm = matrix_norm(a, '1');
+    if (!isfinite(norm)) return NULL;
+    if (n == 0) return matrix_create(0, 0);
+    // P[0] = A (масштабированная), P[1..4] = A^2, A^4, A^6, A^8; U, V, T — рабочие;
+    // в конце — буфер упаковки GEMM, один на все умножения и возведения в квадрат
+    double *buf = malloc((8 * nn + gemm_pack_len(n, n)) * sizeof(double));
+    if (!buf) return NULL;
+    double *A = buf, *P[5] = { A, buf + nn, buf + 2 * nn, buf + 3 * nn, buf + 4 * nn };
+    double *U = buf + 5 * nn, *V = buf + 6 * nn, *T = buf + 7 * nn, *pb = buf + 8 * nn;
+    memcpy(A, a->data, nn * sizeof(double));
+    int m = 13, s = 0;
+    for (int i = 0; i < 4; ++i)
+        if (norm <= expm_theta[i]) { m = 3 + 2 * i; break; }
+    if (m == 13 && norm > expm_theta[4]) {
+        s = (int)ceil(log2(norm / expm_theta[4]));
+        double scale = ldexp(1.0, -s);
+        for (size_t i = 0; i < nn; ++i) A[i] *= scale;
+    }
+    expm_mul(n, A, A, P[1], pb);
+    if (m == 13) {
+        const double *b = expm_b13;
+        expm_mul(n, P[1], P[1], P[2], pb);
+        expm_mul(n, P[2], P[1], P[3], pb);
+        const double *A2 = P[1], *A4 = P[2], *A6 = P[3];
+        // U = A [A6 (b13 A6 + b11 A4 + b9 A2) + b7 A6 + b5 A4 + b3 A2 + b1 I]
+        for (size_t i = 0; i < nn; ++i) T[i] = b[13] * A6[i] + b[11] * A4[i] + b[9] * A2[i];
+        expm_mul(n, A6, T, V, pb);
+        for (size_t i = 0; i < nn; ++i) V[i] += b[7] * A6[i] + b[5] * A4[i] + b[3] * A2[i];
+        for (size_t i = 0; i < n; ++i) V[i * n + i] += b[1];
+        expm_mul(n, A, V, U, pb);
+        // V = A6 (b12 A6 + b10 A4 + b8 A2) + b6 A6 + b4 A4 + b2 A2 + b0 I
+        for (size_t i = 0; i < nn; ++i) T[i] = b[12] * A6[i] + b[10] * A4[i] + b[8] * A2[i];
+        expm_mul(n, A6, T, V, pb);
+        for (size_t i = 0; i < nn; ++i) V[i] += b[6] * A6[i] + b[4] * A4[i] + b[2] * A2[i];
+        for (size_t i = 0; i < n; ++i) V[i * n + i] += b[0];
+    } else {
+        const double *b = m == 3 ? expm_b3 : m == 5 ? expm_b5 : m == 7 ? expm_b7 : expm_b9;
+        int np = (m - 1) / 2; // нужны A^2 .. A^(m-1)
+        for (int j = 2; j <= np; ++j) expm_mul(n, P[j - 1], P[1], P[j], pb);
+        // U = A sum b_{2j+1} A^{2j}, V = sum b_{2j} A^{2j}
+        memset(T, 0, nn * sizeof(double));
+        memset(V, 0, nn * sizeof(double));
+        for (size_t i = 0; i < n; ++i) {
+            T[i * n + i] = b[1];
+            V[i * n + i] = b[0];
+        }
+        for (int j = 1; j <= np; ++j)
+            for (size_t i = 0; i < nn; ++i) {
+                T[i] += b[2 * j + 1] * P[j][i];
+                V[i] += b[2 * j] * P[j][i];
+            }
+        expm_mul(n, A, T, U, pb);
+    }
+    // (V - U) X = V + U
+    Matrix *Q = matrix_create(n, n), *R = matrix_create(n, n), *X = NULL;
+    if (Q && R) {
+        for (size_t i = 0; i < nn; ++i) {
+            Q->data[i] = V[i] - U[i];
+            R->data[i] = V[i] + U[i];
+        }
+        X = matrix_solve(Q, R);
+    }
+    matrix_free(Q);
+    matrix_free(R);
+    // возведение в квадрат s раз, ping-pong между X и T
+    if (X && s > 0) {
+        double *cur = X->data, *oth = T;
+        for (int i = 0; i < s; ++i) {
+            expm_mul(n, cur, cur, oth, pb);
+            double *t = cur; cur = oth; oth = t;
+        }
+        if (cur != X->data) memcpy(X->data, cur, nn * sizeof(double));
+    }
+    free(buf);
+    return X;
+}
+
+/* ====== Кронекерово произведение ====== */
+
+/* (A (x) B)[(i p + r), (j q + s)] = a_ij b_rs для A m x n, B p x q.
+   Строка (i, r) результата — это a_i0 B[r,:], a_i1 B[r,:], ...: запись идёт
+   подряд по строке выхода, строки A и B берутся из кэша. Строки выхода
+   делятся между потоками.
+*/
+typedef struct {
+    const Matrix *a, *b;
+    double *out;
+} KronCtx;
+
+static void kron_rows(size_t lo, size_t hi, void *arg) {
+    const KronCtx *k = arg;
+    size_t n = k->a->cols, p = k->b->rows, q = k->b->cols;
+    for (size_t row = lo; row < hi; ++row) {
+        const double *ai = k->a->data + (row / p) * n, *br = k->b->data + (row % p) * q;
+        double *o = k->out + row * n * q;
+        for (size_t j = 0; j < n; ++j) {
+            double s = ai[j];
+            for (size_t c = 0; c < q; ++c) o[j * q + c] = s * br[c];
+        }
+    }
+}
+
+/* A (x) B в заранее выделенную out размера (m p) x (n q); 0 — размеры не те */
+int matrix_kron_into(const Matrix *a, const Matrix *b, Matrix *out) {
+    if (!a || !b || !out) return 0;
+    if (out->rows != a->rows * b->rows || out->cols != a->cols * b->cols) return 0;
+    KronCtx ctx = { a, b, out->data };
+    size_t rows = out->rows;
+    parallel_for_owned(rows, 1 + ELEM_GRAIN / (out->cols ? out->cols : 1), kron_rows, &ctx);
+    return 1;
+}
+
+Matrix *matrix_kron(const Matrix *a, const Matrix *b) {
+    if (!a || !b) return NULL;
+    Matrix *out = matrix_alloc_struct(a->rows * b->rows, a->cols * b->cols, 0);
+    if (out && !matrix_kron_into(a, b, out)) { matrix_free(out); return NULL; }
+    return out;
+}
+
+/* y = (A (x) B) x без построения A (x) B. В построчном хранении
+   vec(X) — строки X подряд, поэтому для X размера n x q
+       (A (x) B) vec(X) = vec(A X B^T),
+   (в постолбцовой записи то же самое выглядит как B X A^T).
+   x — любая матрица с n q элементами (n x q или вектор n q x 1); результат
+   — m x p, если x была n x q, иначе вектор (m p) x 1. Два GEMM в более
+   дешёвом порядке: (A X) B^T за m q (n + p) или A (X B^T) за n p (q + m).
+   NULL — размеры не совпадают или нет памяти.
+*/
+Matrix *matrix_kron_apply(const Matrix *a, const Matrix *b, const Matrix *x) {
+    if (!a || !b || !x) return NULL;
+    size_t m = a->rows, n = a->cols, p = b->rows, q = b->cols;
+    if (x->rows * x->cols != n * q) return NULL;
+    Matrix *y = (x->rows == n && x->cols == q) ? matrix_create(m, p) : matrix_create(m * p, 1);
+    if (!y) return NULL;
+    if (m * p == 0) return y;
+    int left_first = m * q * (n + p) <= n * p * (q + m);
+    double *t = malloc((left_first ? m * q : n * p) * sizeof(double) + sizeof(double));
+    if (!t) { matrix_free(y); return NULL; }
+    if (left_first) {
+        matrix_gemm(0, 0, m, q, n, 1.0, a->data, n, x->data, q, 0.0, t, q);          // T = A X
+        matrix_gemm(0, 1, m, p, q, 1.0, t, q, b->data, q, 0.0, y->data, p);          // Y = T B^T
+    } else {
+        matrix_gemm(0, 1, n, p, q, 1.0, x->data, q, b->data, q, 0.0, t, p);          // T = X B^T
+        matrix_gemm(0, 0, m, p, n, 1.0, a->data, n, t, p, 0.0, y->data, p);          // Y = A T
+    }
+    free(t);
+    return y;
+}
+
+/* ====== Рандомизированное усечённое SVD ====== */
+
+#define SVD_ROW_BLOCK 256
+
+/* Нормальная случайная величина (Бокс-Мюллер) */
+static double randn(void) {
+    double u1 = (rand() + 1.0) / ((double)RAND_MAX + 2.0);
+    double u2 = rand() / ((double)RAND_MAX + 1.0);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+}
+
+/* Y (m x l) = A X (X: n x l), по блокам строк A */
+static void svd_mult(const Matrix *a, const double *X, size_t l, double *Y) {
+    for (size_t i0 = 0; i0 < a->rows; i0 += SVD_ROW_BLOCK) {
+        size_t rb = (a->rows - i0 < SVD_ROW_BLOCK) ? a->rows - i0 : SVD_ROW_BLOCK;
+        matrix_gemm(0, 0, rb, l, a->cols, 1.0, a->data + i0 * a->cols, a->cols, X, l, 0.0, Y + i0 * l, l);
+    }
+}
+
+/* Z (n x l) = A^T Y (Y: m x l) = sum по блокам строк A_blk^T Y_blk — без копии A^T */
+static void svd_tmult(const Matrix *a, const double *Y, size_t l, double *Z) {
+    memset(Z, 0, a->cols * l * sizeof(double));
+    for (size_t i0 = 0; i0 < a->rows; i0 += SVD_ROW_BLOCK) {
+        size_t rb = (a->rows - i0 < SVD_ROW_BLOCK) ? a->rows - i0 : SVD_ROW_BLOCK;
+        matrix_gemm(1, 0, a->cols, l, rb, 1.0, a->data + i0 * a->cols, a->cols, Y + i0 * l, l, 1.0, Z, l);
+    }
+}
+
+/* Ортонормирование столбцов Y (m x l, m >= l) на месте: Y := Q из QR.
+   Если r != NULL, туда копируется R (l x l). */
+static int orthonormalize(double *Y, size_t m, size_t l, double *r) {
+    size_t ml = m * l;
+    double *tau = malloc((l ? l : 1) * sizeof(double));
+    double *q = calloc(ml ? ml : 1, sizeof(double));
+    int ok = tau && q && qr_factor(Y, m, l, l, tau);
+    if (ok && r)
+        for (size_t i = 0; i < l; ++i)
+            for (size_t j = 0; j < l; ++j) r[i * l + j] = (j >= i) ? Y[i * l + j] : 0.0;
+    if (ok) {
+        for (size_t i = 0; i < l; ++i) q[i * l + i] = 1.0;
+        ok = qr_apply_q(0, Y, m, l, l, tau, q, l, l);
+    }
+    if (ok) memcpy(Y, q, m * l * sizeof(double));
+    free(tau);
+    free(q);
+    return ok;
+}
+
+/* SVD квадратной l x l матрицы односторонним Якоби (Хестенс).
+   Работает со строками rt = R^T (строка j — столбец j матрицы R):
+   на выходе rt[j] = sigma_j w_j, xt[j] — правый сингулярный вектор x_j,
+   R = W diag(sigma) X^T.
+*/
+static void jacobi_svd(double *rt, double *xt, size_t l) {
+    for (size_t i = 0; i < l; ++i)
+        for (size_t j = 0; j < l; ++j) xt[i * l + j] = (i == j) ? 1.0 : 0.0;
+    for (int sweep = 0; sweep < 60; ++sweep) {
+        int rotated = 0;
+        for (size_t p = 0; p + 1 < l; ++p) {
+            for (size_t q = p + 1; q < l; ++q) {
+                double *cp = rt + p * l, *cq = rt + q * l;
+                double alpha = 0.0, beta = 0.0, gamma = 0.0;
+                for (size_t i = 0; i < l; ++i) {
+                    alpha += cp[i] * cp[i];
+                    beta += cq[i] * cq[i];
+                    gamma += cp[i] * cq[i];
+                }
+                if (fabs(gamma) <= DBL_EPSILON * sqrt(alpha * beta) || gamma == 0.0) continue;
+                rotated = 1;
+                double zeta = (beta - alpha) / (2.0 * gamma);
+                double t = copysign(1.0, zeta) / (fabs(zeta) + sqrt(1.0 + zeta * zeta));
+                double c = 1.0 / sqrt(1.0 + t * t), s = c * t;
+                for (size_t i = 0; i < l; ++i) {
+                    double x = cp[i], y = cq[i];
+                    cp[i] = c * x - s * y;
+                    cq[i] = s * x + c * y;
+                }
+                double *vp = xt + p * l, *vq = xt + q * l;
+                for (size_t i = 0; i < l; ++i) {
+                    double x = vp[i], y = vq[i];
+                    vp[i] = c * x - s * y;
+                    vq[i] = s * x + c * y;
+                }
+            }
+        }
+        if (!rotated) break;
+    }
+}
+
+/* Усечённое SVD ранга k рандомизированным поиском подпространства
+   (Halko-Martinsson-Tropp): A ~ U diag(s) V^T, U — m x k, V — n x k,
+   s — k сингулярных чисел по убыванию.
+   Y = A Omega (Omega — n x (k + oversample), гауссова), power_iters
+   шагов степенного метода с переортогонализацией, B = Q^T A и SVD малой B
+   (через QR от B^T и Якоби). A читается только по блокам строк
+   через matrix_gemm — ни копии, ни транспонированной копии не создаётся.
+   Возвращает 1 при успехе.
+*/
+int matrix_svd_randomized(const Matrix *a, size_t k, size_t oversample, size_t power_iters,
+                          Matrix **u, double *s, Matrix **v) {
+    if (!a || !u || !s || !v || k == 0) return 0;
+    size_t m = a->rows, n = a->cols;
+    size_t mn = m < n ? m : n;
+    if (k > mn) return 0;
+    size_t l = k + oversample;
+    if (l > mn) l = mn;
+    double *om = malloc(n * l * sizeof(double));
+    double *Y = malloc(m * l * sizeof(double));
+    double *Z = malloc(n * l * sizeof(double));
+    double *R = malloc(l * l * sizeof(double));
+    double *Xt = malloc(l * l * sizeof(double));
+    double *Wt = malloc(l * l * sizeof(double));
+    double *Uf = malloc(m * l * sizeof(double));
+    double *Vf = malloc(n * l * sizeof(double));
+    EigPair *ord = malloc(l * sizeof(EigPair));
+    Matrix *U = matrix_create(m, k), *V = matrix_create(n, k);
+    int ok = om && Y && Z && R && Xt && Wt && Uf && Vf && ord && U && V;
+    if (ok) {
+        for (size_t i = 0; i < n * l; ++i) om[i] = randn();
+        svd_mult(a, om, l, Y);
+        ok = orthonormalize(Y, m, l, NULL);
+    }
+    for (size_t it = 0; ok && it < power_iters; ++it) {
+        svd_tmult(a, Y, l, Z);
+        ok = orthonormalize(Z, n, l, NULL);
+        if (ok) {
+            svd_mult(a, Z, l, Y);
+            ok = orthonormalize(Y, m, l, NULL);
+        }
+    }
+    if (ok) {
+        // B^T = A^T Q = Qb R, R = W Sigma X^T  =>  A ~ (Q X) Sigma (Qb W)^T
+        svd_tmult(a, Y, l, Z);
+        ok = orthonormalize(Z, n, l, R);
+    }
+    if (ok) {
+        for (size_t i = 0; i < l; ++i)
+            for (size_t j = 0; j < l; ++j) Wt[i * l + j] = R[j * l + i];
+        jacobi_svd(Wt, Xt, l);
+        for (size_t j = 0; j < l; ++j) {
+            double nrm = 0.0;
+            for (size_t i = 0; i < l; ++i) nrm += Wt[j * l + i] * Wt[j * l + i];
+            nrm = sqrt(nrm);
+            ord[j].val = -nrm; // по убыванию
+            ord[j].idx = j;
+            for (size_t i = 0; i < l; ++i) Wt[j * l + i] = (nrm > 0.0) ? Wt[j * l + i] / nrm : 0.0;
+        }
+        qsort(ord, l, sizeof(EigPair), eigpair_cmp);
+        matrix_gemm(0, 1, m, l, l, 1.0, Y, l, Xt, l, 0.0, Uf, l);
+        matrix_gemm(0, 1, n, l, l, 1.0, Z, l, Wt, l, 0.0, Vf, l);
+        for (size_t c = 0; c < k; ++c) {
+            size_t src = ord[c].idx;
+            s[c] = -ord[c].val;
+            for (size_t i = 0; i < m; ++i) U->data[i * k + c] = Uf[i * l + src];
+            for (size_t i = 0; i < n; ++i) V->data[i * k + c] = Vf[i * l + src];
+        }
+    }
+    free(om); free(Y); free(Z); free(R); free(Xt); free(Wt); free(Uf); free(Vf); free(ord);
+    if (!ok) { matrix_free(U); matrix_free(V); return 0; }
+    *u = U;
+    *v = V;
+    return 1;
+}
+
+/* ====== Точный детерминант целочисленных матриц ====== */
+
+/* Все элементы — целые числа, по модулю не больше 2^53 */
+static int matrix_is_integral(const Matrix *a) {
+    for (size_t i = 0; i < a->rows * a->cols; ++i) {
+        double v = a->data[i];
+        if (v != floor(v) || fabs(v) > 9007199254740992.0) return 0;
+    }
+    return 1;
+}
+
+/* Оценка Адамара: log2 |det A| <= sum_i log2 ||a_i||_2 */
+static double hadamard_log2(const Matrix *a) {
+    double bits = 0.0;
+    for (size_t i = 0; i < a->rows; ++i) {
+        double s = 0.0;
+        for (size_t j = 0; j < a->cols; ++j) s += a->data[i * a->cols + j] * a->data[i * a->cols + j];
+        if (s == 0.0) return -INFINITY; // нулевая строка: det = 0
+        bits += 0.5 * log2(s);
+    }
+    return bits;
+}
+
+/* Бареисс без дробей по int64:
+   a_ij <- (a_ij a_kk - a_ik a_kj) / a_{k-1,k-1}, деление точное, все
+   промежуточные значения — миноры исходной матрицы. Произведения считаются
+   в 128 бит; если частное не помещается в int64 — возвращается 0 (переполнение).
+*/
+static int bareiss_det_i64(const Matrix *a, int64_t *det) {
+#if defined(__SIZEOF_INT128__)
+    size_t n = a->rows;
+    int64_t *m = malloc((n ? n * n : 1) * sizeof(int64_t));
+    if (!m) return 0;
+    for (size_t i = 0; i < n * n; ++i) m[i] = (int64_t)a->data[i];
+    int64_t prev = 1;
+    int sign = 1;
+    int ok = 1;
+    *det = 0;
+    for (size_t k = 0; k < n && ok; ++k) {
+        if (m[k * n + k] == 0) {
+            size_t p = k + 1;
+            while (p < n && m[p * n + k] == 0) p++;
+            if (p == n) { free(m); return 1; } // det = 0
+            for (size_t c = 0; c < n; ++c) {
+                int64_t t = m[k * n + c];
+                m[k * n + c] = m[p * n + c];
+                m[p * n + c] = t;
+            }
+            sign = -sign;
+        }
+        int64_t akk = m[k * n + k];
+        for (size_t i = k + 1; i < n && ok; ++i) {
+            int64_t aik = m[i * n + k];
+            for (size_t j = k + 1; j < n; ++j) {
+                __int128 num = (__int128)m[i * n + j] * akk - (__int128)aik * m[k * n + j];
+                __int128 q = num / prev;
+                if (q > INT64_MAX || q < INT64_MIN) { ok = 0; break; }
+                m[i * n + j] = (int64_t)q;
+            }
+            m[i * n + k] = 0;
+        }
+        prev = akk;
+    }
+    int64_t last = n ? m[(n - 1) * n + (n - 1)] : 1;
+    if (last == INT64_MIN && sign < 0) ok = 0; // -INT64_MIN не представим в int64
+    if (ok) *det = last * sign;
+    free(m);
+    return ok;
+#else
+    (void)a;
+    (void)det;
+    return 0;
+#endif
+}
+
+/* Детерминант по простому модулю p < 2^31 (Гаусс над полем Z_p) */
+static uint64_t mod_pow(uint64_t b, uint64_t e, uint64_t p) {
+    uint64_t r = 1;
+    b %= p;
+    while (e) {
+        if (e & 1) r = r * b % p;
+        b = b * b % p;
+        e >>= 1;
+    }
+    return r;
+}
+
+static uint64_t det_mod_p(const Matrix *a, uint64_t p, uint64_t *work) {
+    size_t n = a->rows;
+    for (size_t i = 0; i < n * n; ++i) {
+        int64_t v = (int64_t)a->data[i] % (int64_t)p;
+        work[i] = (uint64_t)(v < 0 ? v + (int64_t)p : v);
+    }
+    uint64_t det = 1;
+    for (size_t k = 0; k < n; ++k) {
+        size_t piv = k;
+        while (piv < n && work[piv * n + k] == 0) piv++;
+        if (piv == n) return 0;
+        if (piv != k) {
+            for (size_t c = k; c < n; ++c) {
+                uint64_t t = work[k * n + c];
+                work[k * n + c] = work[piv * n + c];
+                work[piv * n + c] = t;
+            }
+            det = (p - det) % p;
+        }
+        uint64_t akk = work[k * n + k];
+        det = det * akk % p;
+        uint64_t inv = mod_pow(akk, p - 2, p);
+        for (size_t i = k + 1; i < n; ++i) {
+            uint64_t f = work[i * n + k] * inv % p;
+            if (f == 0) continue;
+            uint64_t nf = p - f;
+            for (size_t c = k + 1; c < n; ++c)
+                work[i * n + c] = (work[i * n + c] + nf * work[k * n + c]) % p;
+        }
+    }
+    return det;
+}
+
+/* Простые числа из (2^30, 2^31), по убыванию */
+static int next_prime_below(uint64_t *p) {
+    for (uint64_t c = *p - 1; c > (1u << 30); --c) {
+        if (c % 2 == 0) continue;
+        int prime = 1;
+        for (uint64_t d = 3; d * d <= c; d += 2)
+            if (c % d == 0) { prime = 0; break; }
+        if (prime) { *p = c; return 1; }
+    }
+    return 0;
+}
+
+typedef struct {
+    const Matrix *a;
+    const uint64_t *primes;
+    uint64_t *residues;
+    atomic_int failed; // нехватка памяти в любом из кусков
+} DetModCtx;
+
+static void det_mod_range(size_t lo, size_t hi, void *arg) {
+    DetModCtx *c = arg;
+    size_t n = c->a->rows;
+    uint64_t *work = malloc((n ? n * n : 1) * sizeof(uint64_t));
+    if (!work) { atomic_store_explicit(&c->failed, 1, memory_order_relaxed); return; }
+    for (size_t t = lo; t < hi; ++t) c->residues[t] = det_mod_p(c->a, c->primes[t], work);
+    free(work);
+}
+
+/* Длинное неотрицательное целое: limbs по 32 бита, младшие первыми */
+typedef struct {
+    uint32_t *d;
+    size_t len;
+} BigNat;
+
+static void bignat_mul_add(BigNat *x, uint32_t mul, uint32_t add) {
+    uint64_t carry = add;
+    for (size_t i = 0; i < x->len; ++i) {
+        uint64_t t = (uint64_t)x->d[i] * mul + carry;
+        x->d[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry) x->d[x->len++] = (uint32_t)carry;
+}
+
+static int bignat_cmp(const BigNat *x, const BigNat *y) {
+    if (x->len != y->len) return x->len < y->len ? -1 : 1;
+    for (size_t i = x->len; i-- > 0;)
+        if (x->d[i] != y->d[i]) return x->d[i] < y->d[i] ? -1 : 1;
+    return 0;
+}
+
+/* x = y - x, при условии y >= x */
+static void bignat_rsub(BigNat *x, const BigNat *y) {
+    int64_t borrow = 0;
+    for (size_t i = 0; i < y->len; ++i) {
+        int64_t t = (int64_t)y->d[i] - (i < x->len ? x->d[i] : 0) - borrow;
+        borrow = t < 0;
+        x->d[i] = (uint32_t)(t + (borrow ? ((int64_t)1 << 32) : 0));
+    }
+    x->len = y->len;
+    while (x->len > 0 && x->d[x->len - 1] == 0) x->len--;
+}
+
+/* Десятичная запись (деструктивно: x обнуляется) */
+static char *bignat_to_string(BigNat *x, int negative) {
+    size_t cap = x->len * 10 + 3;
+    char *buf = malloc(cap);
+    if (!buf) return NULL;
+    size_t pos = cap - 1;
+    buf[pos] = '\0';
+    while (x->len > 0) {
+        uint64_t rem = 0;
+        for (size_t i = x->len; i-- > 0;) {
+            uint64_t cur = (rem << 32) | x->d[i];
+            x->d[i] = (uint32_t)(cur / 1000000000u);
+            rem = cur % 1000000000u;
+        }
+        while (x->len > 0 && x->d[x->len - 1] == 0) x->len--;
+        for (int k = 0; k < 9; ++k) {
+            buf[--pos] = (char)('0' + rem % 10);
+            rem /= 10;
+            if (x->len == 0 && rem == 0) break;
+        }
+    }
+    if (pos == cap - 1) buf[--pos] = '0';
+    if (negative) buf[--pos] = '-';
+    memmove(buf, buf + pos, cap - pos);
+    return buf;
+}
+
+/* Мультимодульный детерминант: det mod p_i для простых p_i < 2^31
+   (параллельно по простым), затем восстановление по КТО (Гарнер).
+   Число простых выбирается по оценке Адамара с запасом на знак.
+*/
+static char *det_multimodular(const Matrix *a) {
+    double bits = hadamard_log2(a);
+    if (bits == -INFINITY) return strdup("0");
+    size_t k = (size_t)ceil((bits + 2.0) / 30.0) + 1;
+    uint64_t *primes = malloc(k * sizeof(uint64_t));
+    uint64_t *res = malloc(k * sizeof(uint64_t));
+    uint64_t *mixed = malloc(k * sizeof(uint64_t));
+    BigNat x = {calloc(k + 2, sizeof(uint32_t)), 0};
+    BigNat m = {calloc(k + 2, sizeof(uint32_t)), 0};
+    char *out = NULL;
+    if (!primes || !res || !mixed || !x.d || !m.d) goto done;
+    uint64_t p = (uint64_t)1 << 31;
+    for (size_t i = 0; i < k; ++i)
+        if (!next_prime_below(&p)) goto done;
+        else primes[i] = p;
+    DetModCtx ctx = {a, primes, res, 0};
+    parallel_for(k, 1, det_mod_range, &ctx);
+    if (ctx.failed) goto done;
+    // Гарнер: det = v0 + v1 p0 + v2 p0 p1 + ...
+    for (size_t i = 0; i < k; ++i) {
+        uint64_t t = res[i];
+        for (size_t j = 0; j < i; ++j) {
+            uint64_t inv = mod_pow(primes[j] % primes[i], primes[i] - 2, primes[i]);
+            t = (t + primes[i] - mixed[j] % primes[i]) % primes[i] * inv % primes[i];
+        }
+        mixed[i] = t;
+    }
+    for (size_t i = k; i-- > 0;) bignat_mul_add(&x, (uint32_t)primes[i], (uint32_t)mixed[i]);
+    // M = prod p_i; отрицательный результат, если 2x > M
+    m.d[0] = 1;
+    m.len = 1;
+    for (size_t i = 0; i < k; ++i) bignat_mul_add(&m, (uint32_t)primes[i], 0);
+    BigNat x2 = {calloc(k + 3, sizeof(uint32_t)), 0};
+    if (!x2.d) goto done;
+    memcpy(x2.d, x.d, x.len * sizeof(uint32_t));
+    x2.len = x.len;
+    bignat_mul_add(&x2, 2, 0);
+    int negative = bignat_cmp(&x2, &m) > 0;
+    free(x2.d);
+    if (negative) bignat_rsub(&x, &m);
+    out = bignat_to_string(&x, negative);
+done:
+    free(primes); free(res); free(mixed); free(x.d); free(m.d);
+    return out;
+}
+
+/* Точный детерминант в int64. Возвращает 1, если матрица целочисленная
+   и детерминант помещается в int64 (Бареисс без переполнения).
+*/
+int matrix_det_int64(const Matrix *a, int64_t *det) {
+    if (!a || a->rows != a->cols || !matrix_is_integral(a)) return 0;
+    return bareiss_det_i64(a, det);
+}
+
+/* Точный детерминант целочисленной матрицы десятичной строкой (malloc).
+   Если оценка Адамара меньше 2^62, переполнение невозможно и считается
+   Бареисс; иначе (или при обнаруженном переполнении) — мультимодульный метод.
+   NULL, если матрица не квадратная или не целочисленная.
+*/
+char *matrix_det_exact(const Matrix *a) {
+    if (!a || a->rows != a->cols || !matrix_is_integral(a)) return NULL;
+    int64_t det;
+    if (hadamard_log2(a) < 62.0 && bareiss_det_i64(a, &det)) {
+        char buf[32];
+        snprintf(buf, sizeof buf, "%lld", (long long)det);
+        return strdup(buf);
+    }
+    return det_multimodular(a);
+}
+
+/* ====== Разреженные матрицы (CSC) и разреженный LU ====== */
+
+/* Разреженная матрица в формате CSC (compressed sparse column):
+   элементы столбца j лежат в rowind/values[colptr[j] .. colptr[j+1]-1],
+   строки внутри столбца упорядочены по возрастанию.
+*/
+typedef struct {
+    size_t rows;
+    size_t cols;
+    size_t nnz;
+    size_t *colptr; // cols + 1
+    size_t *rowind; // nnz
+    double *values; // nnz
+} SparseMatrix;
+
+void sparse_free(SparseMatrix *s) {
+    if (!s) return;
+    free(s->colptr);
+    free(s->rowind);
+    free(s->values);
+    free(s);
+}
+
+SparseMatrix *sparse_create(size_t rows, size_t cols, size_t nnz) {
+    SparseMatrix *s = malloc(sizeof(SparseMatrix));
+    if (!s) return NULL;
+    s->rows = rows;
+    s->cols = cols;
+    s->nnz = nnz;
+    s->colptr = calloc(cols + 1, sizeof(size_t));
+    s->rowind = malloc((nnz ? nnz : 1) * sizeof(size_t));
+    s->values = malloc((nnz ? nnz : 1) * sizeof(double));
+    if (!s->colptr || !s->rowind || !s->values) { sparse_free(s); return NULL; }
+    return s;
+}
+
+/* Сборка CSC из триплетов (i, j, v). Дубликаты суммируются.
+   Сначала раскладываем по строкам, затем обходим строки по порядку и
+   дописываем в столбцы — так строки внутри столбца получаются отсортированными.
+*/
+SparseMatrix *sparse_from_triplets(size_t rows, size_t cols, size_t nnz,
+                                   const size_t *ti, const size_t *tj, const double *tv) {
+    for (size_t k = 0; k < nnz; ++k)
+        if (ti[k] >= rows || tj[k] >= cols) return NULL;
+    size_t *rp = calloc(rows + 1, sizeof(size_t));
+    size_t *rj = malloc((nnz ? nnz : 1) * sizeof(size_t));
+    double *rv = malloc((nnz ? nnz : 1) * sizeof(double));
+    size_t *next = malloc((rows > cols ? rows : cols) * sizeof(size_t) + 1);
+    SparseMatrix *s = sparse_create(rows, cols, nnz);
+    if (!rp || !rj || !rv || !next || !s) {
+        free(rp); free(rj); free(rv); free(next); sparse_free(s);
+        return NULL;
+    }
+    for (size_t k = 0; k < nnz; ++k) rp[ti[k] + 1]++;
+    for (size_t i = 0; i < rows; ++i) rp[i + 1] += rp[i];
+    memcpy(next, rp, rows * sizeof(size_t));
+    for (size_t k = 0; k < nnz; ++k) {
+        size_t p = next[ti[k]]++;
+        rj[p] = tj[k];
+        rv[p] = tv[k];
+    }
+    for (size_t k = 0; k < nnz; ++k) s->colptr[tj[k] + 1]++;
+    for (size_t j = 0; j < cols; ++j) s->colptr[j + 1] += s->colptr[j];
+    memcpy(next, s->colptr, cols * sizeof(size_t));
+    for (size_t i = 0; i < rows; ++i) {
+        for (size_t p = rp[i]; p < rp[i + 1]; ++p) {
+            size_t j = rj[p];
+            size_t q = next[j];
+            if (q > s->colptr[j] && s->rowind[q - 1] == i) {
+                s->values[q - 1] += rv[p]; // дубликат
+            } else {
+                s->rowind[q] = i;
+                s->values[q] = rv[p];
+                next[j]++;
+            }
+        }
+    }
+    // уплотняем после слияния дубликатов
+    size_t w = 0;
+    for (size_t j = 0; j < cols; ++j) {
+        size_t start = s->colptr[j];
+        s->colptr[j] = w;
+        for (size_t p = start; p < next[j]; ++p) {
+            s->rowind[w] = s->rowind[p];
+            s->values[w] = s->values[p];
+            w++;
+        }
+    }
+    s->colptr[cols] = w;
+    s->nnz = w;
+    free(rp); free(rj); free(rv); free(next);
+    return s;
+}
+
+/* Плотная -> разреженная: отбрасываются элементы с |a_ij| <= droptol */
+SparseMatrix *sparse_from_dense(const Matrix *a, double droptol) {
+    if (!a) return NULL;
+    size_t nnz = 0;
+    for (size_t i = 0; i < a->rows * a->cols; ++i)
+        if (fabs(a->data[i]) > droptol) nnz++;
+    SparseMatrix *s = sparse_create(a->rows, a->cols, nnz);
+    if (!s) return NULL;
+    size_t p = 0;
+    for (size_t j = 0; j < a->cols; ++j) {
+        s->colptr[j] = p;
+        for (size_t i = 0; i < a->rows; ++i) {
+            double v = matrix_get(a, i, j);
+            if (fabs(v) > droptol) {
+                s->rowind[p] = i;
+                s->values[p] = v;
+                p++;
+            }
+        }
+    }
+    s->colptr[a->cols] = p;
+    return s;
+}
+
+/* Индекс триплета, прочитанный как double: целое от 0 и меньше 2^53 */
+static int triplet_index(double v, size_t *out) {
+    if (!(v >= 0.0 && v < 9007199254740992.0) || v != floor(v)) return 0;
+    *out = (size_t)v;
+    return 1;
+}
+
+/* Загрузка из текстового формата триплетов:
+   Первая строка: rows cols nnz
+   Далее nnz строк "i j value" (индексы с нуля).
+   Тройки разбираются тем же параллельным разбором, что и плотные матрицы
+   (txt_parse_numbers), как 3·nnz чисел; индексы затем проверяются на
+   целость.
+*/
+SparseMatrix *sparse_load_txt(const char *filename) {
+    FILE *f = fopen(filename, "r");
+    if (!f) return NULL;
+    size_t rows, cols, nnz;
+    if (fscanf(f, "%zu %zu %zu", &rows, &cols, &nnz) != 3 || nnz > SIZE_MAX / (3 * sizeof(double))) {
+        fclose(f);
+        return NULL;
+    }
+    double *raw = malloc((nnz ? 3 * nnz : 1) * sizeof(double));
+    size_t *ti = malloc((nnz ? nnz : 1) * sizeof(size_t));
+    size_t *tj = malloc((nnz ? nnz : 1) * sizeof(size_t));
+    SparseMatrix *s = NULL;
+    if (raw && ti && tj && txt_parse_numbers(f, raw, 3 * nnz, 0)) {
+        size_t k = 0;
+        // значения уплотняются в начало raw: k <= 3k + 2
+        for (; k < nnz; ++k) {
+            if (!triplet_index(raw[3 * k], &ti[k]) || !triplet_index(raw[3 * k + 1], &tj[k])) break;
+            raw[k] = raw[3 * k + 2];
+        }
+        if (k == nnz) s = sparse_from_triplets(rows, cols, nnz, ti, tj, raw);
+    }
+    free(raw); free(ti); free(tj);
+    fclose(f);
+    return s;
+}
+
+/* Знак перестановки (чётность по числу циклов) */
+static int perm_sign(const size_t *p, size_t n) {
+    unsigned char *seen = calloc(n ? n : 1, 1);
+    if (!seen) return 1;
+    int sign = 1;
+    for (size_t i = 0; i < n; ++i) {
+        if (seen[i]) continue;
+        size_t len = 0;
+        for (size_t j = i; !seen[j]; j = p[j]) { seen[j] = 1; len++; }
+        if (len % 2 == 0) sign = -sign;
+    }
+    free(seen);
+    return sign;
+}
+
+/* Шаблон A + A^T без диагонали в виде списков смежности (CSR) */
+static int sparse_sym_pattern(const SparseMatrix *a, size_t **adjp_out, size_t **adj_out) {
+    size_t n = a->cols;
+    size_t *cnt = calloc(n + 1, sizeof(size_t));
+    size_t *mark = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *raw = malloc((2 * a->nnz + 1) * sizeof(size_t));
+    if (!cnt || !mark || !raw) { free(cnt); free(mark); free(raw); return 0; }
+    for (size_t j = 0; j < n; ++j)
+        for (size_t p = a->colptr[j]; p < a->colptr[j + 1]; ++p) {
+            size_t i = a->rowind[p];
+            if (i == j) continue;
+            cnt[i + 1]++;
+            cnt[j + 1]++;
+        }
+    for (size_t i = 0; i < n; ++i) cnt[i + 1] += cnt[i];
+    size_t *pos = mark; // временно используем как позиции вставки
+    memcpy(pos, cnt, n * sizeof(size_t));
+    for (size_t j = 0; j < n; ++j)
+        for (size_t p = a->colptr[j]; p < a->colptr[j + 1]; ++p) {
+            size_t i = a->rowind[p];
+            if (i == j) continue;
+            raw[pos[i]++] = j;
+            raw[pos[j]++] = i;
+        }
+    // удаляем повторы (пары (i,j) и (j,i) дают одно ребро дважды)
+    for (size_t i = 0; i < n; ++i) mark[i] = (size_t)-1;
+    size_t w = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t start = cnt[i];
+        cnt[i] = w;
+        for (size_t p = start; p < cnt[i + 1]; ++p) {
+            size_t j = raw[p];
+            if (mark[j] == i) continue;
+            mark[j] = i;
+            raw[w++] = j;
+        }
+    }
+    cnt[n] = w;
+    free(mark);
+    *adjp_out = cnt;
+    *adj_out = raw;
+    return 1;
+}
+
+/* Динамический список индексов для фактор-графа упорядочивания */
+typedef struct {
+    size_t *v;
+    size_t len;
+    size_t cap;
+} IdxList;
+
+static int idxlist_push(IdxList *l, size_t x) {
+    if (l->len == l->cap) {
+        size_t cap = l->cap ? 2 * l->cap : 4;
+        size_t *v = realloc(l->v, cap * sizeof(size_t));
+        if (!v) return 0;
+        l->v = v;
+        l->cap = cap;
+    }
+    l->v[l->len++] = x;
+    return 1;
+}
+
+/* Упорядочивание приближённой минимальной степени (AMD) на графе A + A^T.
+   Исключение ведётся на фактор-графе: исключённая вершина становится
+   "элементом", хранящим своё множество соседей L_e, поглощённые элементы
+   удаляются, поэтому память не растёт с заполнением. Степень оценивается
+   сверху как в AMD: |A_i| + |L_p \ i| + сумма |L_e \ L_p|.
+   Упрощение: без суперпеременных и агрессивного поглощения.
+   Возвращает perm: perm[k] — вершина, исключаемая на шаге k.
+*/
+static size_t *sparse_amd_order(size_t n, const size_t *adjp, const size_t *adj) {
+    size_t *perm = malloc((n ? n : 1) * sizeof(size_t));
+    IdxList *var = calloc(n ? n : 1, sizeof(IdxList));  // смежные переменные
+    IdxList *elm = calloc(n ? n : 1, sizeof(IdxList));  // смежные элементы
+    IdxList *le = calloc(n ? n : 1, sizeof(IdxList));   // L_e для элементов
+    unsigned char *status = calloc(n ? n : 1, 1);       // 0 переменная, 1 элемент, 2 поглощён
+    size_t *deg = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *head = malloc((n + 1) * sizeof(size_t));
+    size_t *next = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *prev = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *mark = calloc(n ? n : 1, sizeof(size_t));
+    size_t *wst = calloc(n ? n : 1, sizeof(size_t));
+    size_t *w = malloc((n ? n : 1) * sizeof(size_t));
+    const size_t NONE = (size_t)-1;
+    int ok = perm && var && elm && le && status && deg && head && next && prev && mark && wst && w;
+
+    for (size_t i = 0; ok && i < n; ++i) {
+        size_t d = adjp[i + 1] - adjp[i];
+        var[i].v = malloc((d ? d : 1) * sizeof(size_t));
+        if (!var[i].v) { ok = 0; break; }
+        memcpy(var[i].v, adj + adjp[i], d * sizeof(size_t));
+        var[i].len = var[i].cap = d;
+    }
+    if (ok) {
+        for (size_t d = 0; d <= n; ++d) head[d] = NONE;
+        for (size_t i = 0; i < n; ++i) {
+            deg[i] = var[i].len;
+            prev[i] = NONE;
+            next[i] = head[deg[i]];
+            if (next[i] != NONE) prev[next[i]] = i;
+            head[deg[i]] = i;
+        }
     }
-}
+    size_t mindeg = 0, stamp = 0;
+    for (size_t k = 0; ok && k < n; ++k) {
+        // 1) вершина минимальной степени
+        while (head[mindeg] == NONE) mindeg++;
+        size_t p = head[mindeg];
+        head[mindeg] = next[p];
+        if (next[p] != NONE) prev[next[p]] = NONE;
+        perm[k] = p;
+        status[p] = 1;
 
-/* Ввод матрицы вручную */
-void matrix_input(Matrix *m) {
-    printf("Ввод матрицы %zux%zu (по элементам):\n", m->rows, m->cols);
-    for (size_t i = 0; i < m->rows; ++i) {
-        for (size_t j = 0; j < m->cols; ++j) {
-            double v;
-            printf("A[%zu][%zu] = ", i, j);
-            while (scanf("%lf", &v) != 1) {
-                while (getchar() != '\n'); // чистим ввод
-                printf("Неверный ввод. Попробуйте снова: ");
+        // 2) L_p = A_p ∪ (объединение L_e по e ∈ E_p) \ {p}
+        stamp++;
+        mark[p] = stamp;
+        IdxList lp = {NULL, 0, 0};
+        for (size_t t = 0; t < var[p].len && ok; ++t) {
+            size_t i = var[p].v[t];
+            if (mark[i] != stamp) { mark[i] = stamp; ok = idxlist_push(&lp, i); }
+        }
+        for (size_t t = 0; t < elm[p].len && ok; ++t) {
+            size_t e = elm[p].v[t];
+            if (status[e] != 1) continue;
+            for (size_t u = 0; u < le[e].len && ok; ++u) {
+                size_t i = le[e].v[u];
+                if (mark[i] != stamp && status[i] == 0) { mark[i] = stamp; ok = idxlist_push(&lp, i); }
             }
-            matrix_set(m, i, j, v);
+            status[e] = 2; // элемент e поглощается p
+            free(le[e].v);
+            le[e].v = NULL;
+            le[e].len = le[e].cap = 0;
+        }
+        if (!ok) { free(lp.v); break; }
+
+        // 3) чистим списки соседей и считаем |L_e \ L_p|
+        stamp++;
+        size_t wstamp = stamp;
+        for (size_t t = 0; t < lp.len; ++t) {
+            size_t i = lp.v[t];
+            // убираем i из корзины степеней
+            if (prev[i] != NONE) next[prev[i]] = next[i];
+            else head[deg[i]] = next[i];
+            if (next[i] != NONE) prev[next[i]] = prev[i];
+            // E_i: без поглощённых, плюс новый элемент p
+            size_t wr = 0;
+            for (size_t u = 0; u < elm[i].len; ++u) {
+                size_t e = elm[i].v[u];
+                if (status[e] == 1) elm[i].v[wr++] = e;
+            }
+            elm[i].len = wr;
+            // A_i: без p и без переменных из L_p (они теперь достижимы через p)
+            wr = 0;
+            for (size_t u = 0; u < var[i].len; ++u) {
+                size_t j = var[i].v[u];
+                if (j != p && !(mark[j] == stamp - 1 && status[j] == 0)) var[i].v[wr++] = j;
+            }
+            var[i].len = wr;
+            for (size_t u = 0; u < elm[i].len; ++u) {
+                size_t e = elm[i].v[u];
+                if (wst[e] != wstamp) { wst[e] = wstamp; w[e] = le[e].len; }
+                w[e]--;
+            }
+        }
+        size_t remaining = n - k - 1;
+        for (size_t t = 0; t < lp.len && ok; ++t) {
+            size_t i = lp.v[t];
+            size_t d = var[i].len + lp.len - 1;
+            for (size_t u = 0; u < elm[i].len; ++u) d += w[elm[i].v[u]];
+            if (d > deg[i] + lp.len - 1) d = deg[i] + lp.len - 1;
+            if (d > remaining - 1) d = remaining - 1;
+            ok = idxlist_push(&elm[i], p);
+            deg[i] = d;
+            prev[i] = NONE;
+            next[i] = head[d];
+            if (next[i] != NONE) prev[next[i]] = i;
+            head[d] = i;
+            if (d < mindeg) mindeg = d;
         }
+        le[p] = lp;
+        free(var[p].v); var[p].v = NULL; var[p].len = var[p].cap = 0;
+        free(elm[p].v); elm[p].v = NULL; elm[p].len = elm[p].cap = 0;
     }
-}
 
-/* Заполнение случайными числами в диапазоне [minv, maxv] */
-void matrix_random(Matrix *m, double minv, double maxv) {
-    for (size_t i = 0; i < m->rows; ++i)
-        for (size_t j = 0; j < m->cols; ++j)
-            matrix_set(m, i, j, minv + (maxv - minv) * (rand() / (double)RAND_MAX));
+    for (size_t i = 0; i < n; ++i) {
+        if (var) free(var[i].v);
+        if (elm) free(elm[i].v);
+        if (le) free(le[i].v);
+    }
+    free(var); free(elm); free(le); free(status); free(deg); free(head);
+    free(next); free(prev); free(mark); free(wst); free(w);
+    if (!ok) { free(perm); return NULL; }
+    return perm;
 }
 
-/* Копирование */
-Matrix *matrix_clone(const Matrix *a) {
-    Matrix *b = matrix_create(a->rows, a->cols);
-    if (!b) return NULL;
-    memcpy(b->data, a->data, sizeof(double) * a->rows * a->cols);
-    return b;
-}
+/* Символьная часть разреженного LU: упорядочивание столбцов и оценка заполнения.
+   Зависит только от шаблона A, поэтому переиспользуется для всех матриц
+   с тем же шаблоном.
+*/
+typedef struct {
+    size_t n;
+    size_t nnz;
+    size_t *colptr;  // копия шаблона A для проверки совпадения
+    size_t *rowind;
+    size_t *q;       // порядок столбцов: на шаге k обрабатывается столбец q[k]
+    size_t lnz_est;  // оценка nnz(L) (по дереву исключения A + A^T)
+    size_t unz_est;
+} SparseLUSymbolic;
 
-/* Сложение/вычитание */
-Matrix *matrix_add_sub(const Matrix *a, const Matrix *b, int subtract) {
-    if (!a || !b) return NULL;
-    if (a->rows != b->rows || a->cols != b->cols) return NULL;
-    Matrix *c = matrix_create(a->rows, a->cols);
-    if (!c) return NULL;
-    for (size_t i = 0; i < a->rows * a->cols; ++i)
-        c->data[i] = a->data[i] + (subtract ? -b->data[i] : b->data[i]);
-    return c;
+void sparse_lu_symbolic_free(SparseLUSymbolic *s) {
+    if (!s) return;
+    free(s->colptr);
+    free(s->rowind);
+    free(s->q);
+    free(s);
 }
 
-/* Умножение */
-Matrix *matrix_multiply(const Matrix *a, const Matrix *b) {
-    if (!a || !b) return NULL;
-    if (a->cols != b->rows) return NULL;
-    Matrix *c = matrix_create(a->rows, b->cols);
-    if (!c) return NULL;
-    for (size_t i = 0; i < a->rows; ++i) {
-        for (size_t k = 0; k < a->cols; ++k) {
-            double aik = matrix_get(a, i, k);
-            for (size_t j = 0; j < b->cols; ++j) {
-                c->data[i * c->cols + j] += aik * matrix_get(b, k, j);
+SparseLUSymbolic *sparse_lu_symbolic(const SparseMatrix *a) {
+    if (!a || a->rows != a->cols) return NULL;
+    size_t n = a->cols;
+    size_t *adjp = NULL, *adj = NULL;
+    if (!sparse_sym_pattern(a, &adjp, &adj)) return NULL;
+    SparseLUSymbolic *s = calloc(1, sizeof(SparseLUSymbolic));
+    size_t *pinv = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *parent = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *anc = malloc((n ? n : 1) * sizeof(size_t));
+    if (!s || !pinv || !parent || !anc) goto fail;
+    s->n = n;
+    s->nnz = a->nnz;
+    s->colptr = malloc((n + 1) * sizeof(size_t));
+    s->rowind = malloc((a->nnz ? a->nnz : 1) * sizeof(size_t));
+    s->q = sparse_amd_order(n, adjp, adj);
+    if (!s->colptr || !s->rowind || !s->q) goto fail;
+    memcpy(s->colptr, a->colptr, (n + 1) * sizeof(size_t));
+    memcpy(s->rowind, a->rowind, a->nnz * sizeof(size_t));
+
+    // Дерево исключения переставленной A + A^T и число элементов L
+    // обходом поддеревьев строк: O(nnz(L)).
+    const size_t NONE = (size_t)-1;
+    for (size_t k = 0; k < n; ++k) pinv[s->q[k]] = k;
+    for (size_t k = 0; k < n; ++k) {
+        parent[k] = NONE;
+        anc[k] = NONE;
+        size_t v = s->q[k];
+        for (size_t t = adjp[v]; t < adjp[v + 1]; ++t) {
+            size_t i = pinv[adj[t]];
+            while (i != NONE && i < k) {
+                size_t inext = anc[i];
+                anc[i] = k;
+                if (inext == NONE) { parent[i] = k; break; }
+                i = inext;
             }
         }
     }
-    return c;
+    size_t lnz = n;
+    size_t *flag = anc; // переиспользуем как метки
+    for (size_t k = 0; k < n; ++k) {
+        flag[k] = k;
+        size_t v = s->q[k];
+        for (size_t t = adjp[v]; t < adjp[v + 1]; ++t) {
+            size_t i = pinv[adj[t]];
+            if (i > k) continue;
+            for (; flag[i] != k; i = parent[i]) {
+                flag[i] = k;
+                lnz++;
+            }
+        }
+    }
+    s->lnz_est = lnz;
+    s->unz_est = lnz;
+    free(adjp); free(adj); free(pinv); free(parent); free(anc);
+    return s;
+fail:
+    free(adjp); free(adj); free(pinv); free(parent); free(anc);
+    sparse_lu_symbolic_free(s);
+    return NULL;
 }
 
-/* Транспонирование */
-Matrix *matrix_transpose(const Matrix *a) {
-    Matrix *t = matrix_create(a->cols, a->rows);
-    if (!t) return NULL;
-    for (size_t i = 0; i < a->rows; ++i)
-        for (size_t j = 0; j < a->cols; ++j)
-            matrix_set(t, j, i, matrix_get(a, i, j));
-    return t;
+/* Численная часть: P A Q = L U.
+   L хранится по столбцам с единичной диагональю (не хранится),
+   U — по столбцам без диагонали, диагональ отдельно в udiag.
+   Индексы строк L и U — в порядке шагов исключения, по возрастанию.
+*/
+typedef struct {
+    size_t n;
+    size_t *lp, *li; double *lx;
+    size_t *up, *ui; double *ux;
+    double *udiag;
+    size_t *prow;  // prow[k] — исходная строка, выбранная опорной на шаге k
+    size_t *pinv;  // обратная к prow
+    size_t *q;     // порядок столбцов (копия из символьной части)
+    int sign;      // знак перестановок P и Q
+} SparseLUNumeric;
+
+#define SPARSE_LU_PIVOT_TOL 1e-3 // порог предпочтения диагонального опорного элемента
+
+void sparse_lu_numeric_free(SparseLUNumeric *f) {
+    if (!f) return;
+    free(f->lp); free(f->li); free(f->lx);
+    free(f->up); free(f->ui); free(f->ux);
+    free(f->udiag); free(f->prow); free(f->pinv); free(f->q);
+    free(f);
 }
 
-/* Сохранение/загрузка в простой текстовый формат:
-   Первая строка: rows cols
-   Далее rows строк по cols чисел.
-*/
-int matrix_save_txt(const Matrix *m, const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) return 0;
-    fprintf(f, "%zu %zu\n", m->rows, m->cols);
-    for (size_t i = 0; i < m->rows; ++i) {
-        for (size_t j = 0; j < m->cols; ++j) {
-            fprintf(f, "%.12g ", matrix_get(m, i, j));
+/* Сортировка строк внутри столбцов CSC двойным транспонированием, O(nnz) */
+static int csc_sort_rows(size_t n, const size_t *p, size_t *idx, double *x) {
+    size_t nnz = p[n];
+    size_t *tp = calloc(n + 1, sizeof(size_t));
+    size_t *tj = malloc((nnz ? nnz : 1) * sizeof(size_t));
+    double *tx = malloc((nnz ? nnz : 1) * sizeof(double));
+    size_t *pos = malloc((n ? n : 1) * sizeof(size_t));
+    if (!tp || !tj || !tx || !pos) { free(tp); free(tj); free(tx); free(pos); return 0; }
+    for (size_t t = 0; t < nnz; ++t) tp[idx[t] + 1]++;
+    for (size_t i = 0; i < n; ++i) tp[i + 1] += tp[i];
+    memcpy(pos, tp, n * sizeof(size_t));
+    for (size_t j = 0; j < n; ++j)
+        for (size_t t = p[j]; t < p[j + 1]; ++t) {
+            size_t d = pos[idx[t]]++;
+            tj[d] = j;
+            tx[d] = x[t];
         }
-        fprintf(f, "\n");
-    }
-    fclose(f);
+    memcpy(pos, p, n * sizeof(size_t));
+    for (size_t i = 0; i < n; ++i)
+        for (size_t t = tp[i]; t < tp[i + 1]; ++t) {
+            size_t d = pos[tj[t]]++;
+            idx[d] = i;
+            x[d] = tx[t];
+        }
+    free(tp); free(tj); free(tx); free(pos);
     return 1;
 }
 
-Matrix *matrix_load_txt(const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) return NULL;
-    size_t rows, cols;
-    if (fscanf(f, "%zu %zu", &rows, &cols) != 2) { fclose(f); return NULL; }
-    Matrix *m = matrix_create(rows, cols);
-    if (!m) { fclose(f); return NULL; }
-    for (size_t i = 0; i < rows; ++i)
-        for (size_t j = 0; j < cols; ++j)
-            if (fscanf(f, "%lf", &m->data[i * cols + j]) != 1) {
-                matrix_free(m);
-                fclose(f);
-                return NULL;
-            }
-    fclose(f);
-    return m;
+static int sparse_grow(size_t **idx, double **x, size_t *cap, size_t need) {
+    if (need <= *cap) return 1;
+    size_t cap2 = *cap * 2;
+    if (cap2 < need) cap2 = need;
+    size_t *i2 = realloc(*idx, cap2 * sizeof(size_t));
+    if (!i2) return 0;
+    *idx = i2;
+    double *x2 = realloc(*x, cap2 * sizeof(double));
+    if (!x2) return 0;
+    *x = x2;
+    *cap = cap2;
+    return 1;
 }
 
-/* ====== Линейная алгебра: детерминант и обратная матрица ====== */
+static int sparse_same_pattern(const SparseMatrix *a, const SparseLUSymbolic *sym) {
+    return a->rows == sym->n && a->cols == sym->n && a->nnz == sym->nnz &&
+           memcmp(a->colptr, sym->colptr, (sym->n + 1) * sizeof(size_t)) == 0 &&
+           memcmp(a->rowind, sym->rowind, sym->nnz * sizeof(size_t)) == 0;
+}
 
-/* Вычисление детерминанта квадратной матрицы методом приведения к верхней треугольной форме.
-   Возвращает 0 если не квадратная. Работает с копией матрицы (не изменяет входную).
+/* Левосторонний LU Гилберта-Пейерлса: столбец k получается решением
+   разреженной треугольной системы с уже готовыми столбцами L,
+   шаблон решения находится DFS по графу L. Выбор опорного элемента —
+   частичный, с предпочтением диагонали (порог SPARSE_LU_PIVOT_TOL),
+   чтобы сохранить заполнение, предсказанное упорядочиванием.
+   Возвращает NULL при несовпадении шаблона, нехватке памяти или
+   вырожденной матрице.
 */
-double matrix_determinant(const Matrix *a) {
-    if (!a) return 0.0;
-    if (a->rows != a->cols) {
-        fprintf(stderr, "Determinant: matrix is not square\n");
-        return 0.0;
-    }
-    size_t n = a->rows;
-    // Копируем в рабочую матрицу
-    double *mat = malloc(n * n * sizeof(double));
-    if (!mat) return 0.0;
-    memcpy(mat, a->data, n * n * sizeof(double));
+SparseLUNumeric *sparse_lu_numeric(const SparseMatrix *a, const SparseLUSymbolic *sym) {
+    if (!a || !sym || !sparse_same_pattern(a, sym)) return NULL;
+    size_t n = sym->n;
+    const size_t NONE = (size_t)-1;
+    SparseLUNumeric *f = calloc(1, sizeof(SparseLUNumeric));
+    if (!f) return NULL;
+    f->n = n;
+    size_t lcap = sym->lnz_est + 1, ucap = sym->unz_est + 1;
+    f->lp = malloc((n + 1) * sizeof(size_t));
+    f->up = malloc((n + 1) * sizeof(size_t));
+    f->li = malloc(lcap * sizeof(size_t));
+    f->lx = malloc(lcap * sizeof(double));
+    f->ui = malloc(ucap * sizeof(size_t));
+    f->ux = malloc(ucap * sizeof(double));
+    f->udiag = malloc((n ? n : 1) * sizeof(double));
+    f->prow = malloc((n ? n : 1) * sizeof(size_t));
+    f->pinv = malloc((n ? n : 1) * sizeof(size_t));
+    f->q = malloc((n ? n : 1) * sizeof(size_t));
+    double *x = calloc(n ? n : 1, sizeof(double));
+    size_t *xi = malloc((n ? n : 1) * sizeof(size_t));     // шаблон (стек результата)
+    size_t *stack = malloc((n ? n : 1) * sizeof(size_t));  // стек DFS
+    size_t *pstack = malloc((n ? n : 1) * sizeof(size_t));
+    size_t *mark = malloc((n ? n : 1) * sizeof(size_t));
+    if (!f->lp || !f->up || !f->li || !f->lx || !f->ui || !f->ux || !f->udiag ||
+        !f->prow || !f->pinv || !f->q || !x || !xi || !stack || !pstack || !mark)
+        goto fail;
+    memcpy(f->q, sym->q, n * sizeof(size_t));
+    for (size_t i = 0; i < n; ++i) { f->pinv[i] = NONE; mark[i] = NONE; }
 
-    double det = 1.0;
-    int sign = 1;
-    for (size_t i = 0; i < n; ++i) {
-        // Поиск опорного элемента (pivot)
-        size_t piv = i;
-        for (size_t r = i; r < n; ++r) {
-            if (fabs(mat[r*n + i]) > fabs(mat[piv*n + i])) piv = r;
+    size_t lnz = 0, unz = 0;
+    for (size_t k = 0; k < n; ++k) {
+        size_t col = f->q[k];
+        f->lp[k] = lnz;
+        f->up[k] = unz;
+        if (!sparse_grow(&f->li, &f->lx, &lcap, lnz + n) ||
+            !sparse_grow(&f->ui, &f->ux, &ucap, unz + n))
+            goto fail;
+
+        // Шаблон x = L \ A(:,col): обратный постпорядок DFS из строк A(:,col)
+        size_t top = n;
+        for (size_t t = a->colptr[col]; t < a->colptr[col + 1]; ++t) {
+            size_t r = a->rowind[t];
+            if (mark[r] == k) continue;
+            size_t sp = 0;
+            stack[0] = r;
+            mark[r] = k;
+            pstack[0] = (f->pinv[r] != NONE) ? f->lp[f->pinv[r]] : 0;
+            while (sp != NONE) {
+                size_t j = stack[sp];
+                size_t c = f->pinv[j];
+                int pushed = 0;
+                if (c != NONE) {
+                    size_t end = f->lp[c + 1];
+                    for (size_t t2 = pstack[sp]; t2 < end; ++t2) {
+                        size_t i = f->li[t2];
+                        if (mark[i] == k) continue;
+                        pstack[sp] = t2 + 1;
+                        mark[i] = k;
+                        stack[++sp] = i;
+                        pstack[sp] = (f->pinv[i] != NONE) ? f->lp[f->pinv[i]] : 0;
+                        pushed = 1;
+                        break;
+                    }
+                }
+                if (!pushed) {
+                    xi[--top] = j;
+                    sp = (sp == 0) ? NONE : sp - 1;
+                }
+            }
         }
-        if (fabs(mat[piv*n + i]) < EPS) {
-            det = 0.0;
-            break;
+
+        // Численная фаза: разреженная прямая подстановка
+        for (size_t t = a->colptr[col]; t < a->colptr[col + 1]; ++t)
+            x[a->rowind[t]] = a->values[t];
+        for (size_t t = top; t < n; ++t) {
+            size_t j = xi[t];
+            size_t c = f->pinv[j];
+            if (c == NONE) continue;
+            double xj = x[j];
+            for (size_t t2 = f->lp[c]; t2 < f->lp[c + 1]; ++t2)
+                x[f->li[t2]] -= f->lx[t2] * xj;
         }
-        if (piv != i) {
-            // swap rows i and piv
-            for (size_t c = 0; c < n; ++c) {
-                double tmp = mat[i*n + c];
-                mat[i*n + c] = mat[piv*n + c];
-                mat[piv*n + c] = tmp;
+
+        // Выбор опорного элемента среди ещё не выбранных строк
+        size_t ipiv = NONE;
+        double amax = 0.0;
+        for (size_t t = top; t < n; ++t) {
+            size_t j = xi[t];
+            if (f->pinv[j] != NONE) {
+                f->ui[unz] = f->pinv[j];
+                f->ux[unz] = x[j];
+                unz++;
+            } else if (fabs(x[j]) > amax) {
+                amax = fabs(x[j]);
+                ipiv = j;
             }
-            sign = -sign;
         }
-        double pivot = mat[i*n + i];
-        det *= pivot;
-        // нормируем и вычитаем
-        for (size_t r = i + 1; r < n; ++r) {
-            double factor = mat[r*n + i] / pivot;
-            for (size_t c = i; c < n; ++c) {
-                mat[r*n + c] -= factor * mat[i*n + c];
+        if (ipiv == NONE || amax == 0.0) goto fail; // вырожденная матрица
+        if (f->pinv[col] == NONE && mark[col] == k &&
+            fabs(x[col]) >= SPARSE_LU_PIVOT_TOL * amax)
+            ipiv = col;
+        double pivot = x[ipiv];
+        f->udiag[k] = pivot;
+        f->prow[k] = ipiv;
+        f->pinv[ipiv] = k;
+        for (size_t t = top; t < n; ++t) {
+            size_t j = xi[t];
+            if (f->pinv[j] == NONE) {
+                f->li[lnz] = j;
+                f->lx[lnz] = x[j] / pivot;
+                lnz++;
             }
+            x[j] = 0.0;
         }
     }
-    det *= sign;
-    free(mat);
-    return det;
+    f->lp[n] = lnz;
+    f->up[n] = unz;
+    // строки L — в порядке шагов, затем сортировка столбцов L и U
+    for (size_t t = 0; t < lnz; ++t) f->li[t] = f->pinv[f->li[t]];
+    if (!csc_sort_rows(n, f->lp, f->li, f->lx) || !csc_sort_rows(n, f->up, f->ui, f->ux))
+        goto fail;
+    f->sign = perm_sign(f->prow, n) * perm_sign(f->q, n);
+    free(x); free(xi); free(stack); free(pstack); free(mark);
+    return f;
+fail:
+    free(x); free(xi); free(stack); free(pstack); free(mark);
+    sparse_lu_numeric_free(f);
+    return NULL;
 }
 
-/* Обратная матрица методом Гаусса-Жордана.
-   Возвращает NULL, если матрица не квадратная или необратима.
+/* Повторная численная факторизация матрицы с тем же шаблоном:
+   переиспользует и упорядочивание, и последовательность опорных элементов,
+   и шаблоны L/U — без DFS и без выбора опорных. Возвращает 0, если опорный
+   элемент стал нулевым или слишком мал (тогда нужен sparse_lu_numeric).
 */
-Matrix *matrix_inverse(const Matrix *a) {
-    if (!a) return NULL;
-    if (a->rows != a->cols) {
-        fprintf(stderr, "Inverse: matrix is not square\n");
-        return NULL;
-    }
-    size_t n = a->rows;
-    // Создаём расширенную матрицу nx(2n)
-    double *E = malloc(n * 2 * n * sizeof(double));
-    if (!E) return NULL;
-    // Заполняем [A | I]
-    for (size_t i = 0; i < n; ++i) {
-        for (size_t j = 0; j < n; ++j) {
-            E[i*(2*n) + j] = matrix_get(a, i, j);
-            E[i*(2*n) + (n + j)] = (i == j) ? 1.0 : 0.0;
+int sparse_lu_refactor(const SparseMatrix *a, const SparseLUSymbolic *sym, SparseLUNumeric *f) {
+    if (!a || !sym || !f || f->n != sym->n || !sparse_same_pattern(a, sym)) return 0;
+    size_t n = f->n;
+    double *x = calloc(n ? n : 1, sizeof(double));
+    if (!x) return 0;
+    int ok = 1;
+    for (size_t k = 0; k < n && ok; ++k) {
+        size_t col = f->q[k];
+        for (size_t t = a->colptr[col]; t < a->colptr[col + 1]; ++t)
+            x[f->pinv[a->rowind[t]]] = a->values[t];
+        // строки U(:,k) по возрастанию — топологический порядок для L
+        for (size_t t = f->up[k]; t < f->up[k + 1]; ++t) {
+            size_t r = f->ui[t];
+            double xr = x[r];
+            f->ux[t] = xr;
+            x[r] = 0.0;
+            for (size_t t2 = f->lp[r]; t2 < f->lp[r + 1]; ++t2)
+                x[f->li[t2]] -= f->lx[t2] * xr;
+        }
+        double pivot = x[k];
+        x[k] = 0.0;
+        double amax = fabs(pivot);
+        for (size_t t = f->lp[k]; t < f->lp[k + 1]; ++t)
+            if (fabs(x[f->li[t]]) > amax) amax = fabs(x[f->li[t]]);
+        if (pivot == 0.0 || fabs(pivot) < SPARSE_LU_PIVOT_TOL * amax) ok = 0;
+        f->udiag[k] = pivot;
+        for (size_t t = f->lp[k]; t < f->lp[k + 1]; ++t) {
+            f->lx[t] = ok ? x[f->li[t]] / pivot : 0.0;
+            x[f->li[t]] = 0.0;
         }
     }
+    free(x);
+    return ok;
+}
 
-    // Прямой ход
-    for (size_t i = 0; i < n; ++i) {
-        // pivot selection
-        size_t piv = i;
-        for (size_t r = i; r < n; ++r)
-            if (fabs(E[r*(2*n) + i]) > fabs(E[piv*(2*n) + i])) piv = r;
-        if (fabs(E[piv*(2*n) + i]) < EPS) {
-            free(E);
-            return NULL; // сингулярная матрица
-        }
-        // swap rows if needed
-        if (piv != i) {
-            for (size_t c = 0; c < 2*n; ++c) {
-                double tmp = E[i*(2*n) + c];
-                E[i*(2*n) + c] = E[piv*(2*n) + c];
-                E[piv*(2*n) + c] = tmp;
-            }
-        }
-        // normalize row i
-        double div = E[i*(2*n) + i];
-        for (size_t c = 0; c < 2*n; ++c) E[i*(2*n) + c] /= div;
-        // eliminate other rows
-        for (size_t r = 0; r < n; ++r) {
-            if (r == i) continue;
-            double factor = E[r*(2*n) + i];
-            if (fabs(factor) < EPS) continue;
-            for (size_t c = 0; c < 2*n; ++c)
-                E[r*(2*n) + c] -= factor * E[i*(2*n) + c];
-        }
+/* Решение A x = b по готовым множителям, b перезаписывается решением */
+int sparse_lu_solve(const SparseLUNumeric *f, double *b) {
+    if (!f || !b) return 0;
+    size_t n = f->n;
+    double *y = malloc((n ? n : 1) * sizeof(double));
+    if (!y) return 0;
+    for (size_t k = 0; k < n; ++k) y[k] = b[f->prow[k]];
+    for (size_t k = 0; k < n; ++k) {
+        double yk = y[k];
+        if (yk == 0.0) continue;
+        for (size_t t = f->lp[k]; t < f->lp[k + 1]; ++t)
+            y[f->li[t]] -= f->lx[t] * yk;
+    }
+    for (size_t k = n; k-- > 0;) {
+        y[k] /= f->udiag[k];
+        double yk = y[k];
+        if (yk == 0.0) continue;
+        for (size_t t = f->up[k]; t < f->up[k + 1]; ++t)
+            y[f->ui[t]] -= f->ux[t] * yk;
     }
+    for (size_t k = 0; k < n; ++k) b[f->q[k]] = y[k];
+    free(y);
+    return 1;
+}
 
-    // Результат в правой половине
-    Matrix *inv = matrix_create(n, n);
-    if (!inv) { free(E); return NULL; }
-    for (size_t i = 0; i < n; ++i)
-        for (size_t j = 0; j < n; ++j)
-            inv->data[i*n + j] = E[i*(2*n) + (n + j)];
+double sparse_lu_determinant(const SparseLUNumeric *f) {
+    if (!f) return 0.0;
+    double det = f->sign;
+    for (size_t k = 0; k < f->n; ++k) det *= f->udiag[k];
+    return det;
+}
 
-    free(E);
-    return inv;
+/* log|det| по готовым множителям, знак в *sign (как matrix_logdet) */
+double sparse_lu_logdet(const SparseLUNumeric *f, int *sign) {
+    if (!f) { if (sign) *sign = 0; return -INFINITY; }
+    double m = 0.5; // 1 = 0.5 * 2^1
+    long e = 1;
+    int sg = f->sign;
+    for (size_t k = 0; k < f->n; ++k) {
+        if (f->udiag[k] < 0.0) sg = -sg;
+        det_accumulate(&m, &e, f->udiag[k]);
+    }
+    if (sign) *sign = sg;
+    return log(m) + (double)e * log(2.0);
+}
+
+/* Детерминант разреженной матрицы без уплотнения: 0 для вырожденной */
+double sparse_determinant(const SparseMatrix *a) {
+    SparseLUSymbolic *sym = sparse_lu_symbolic(a);
+    if (!sym) return 0.0;
+    SparseLUNumeric *f = sparse_lu_numeric(a, sym);
+    double det = f ? sparse_lu_determinant(f) : 0.0;
+    sparse_lu_numeric_free(f);
+    sparse_lu_symbolic_free(sym);
+    return det;
 }
 
 /* ====== Меню и взаимодействие с пользователем ====== */
 
+/* При сборке как библиотеки (например, для matrix.hpp) меню и main
+   исключаются: gcc -c -DMATRIX_NO_MAIN matrix.c
+*/
+#ifndef MATRIX_NO_MAIN
+
 void flush_stdin(void) {
     int c;
     while ((c = getchar()) != '\n' && c != EOF) {}
 }
 
+/* Монотонное время в секундах — для замеров скорости в меню */
+static double wall_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Пакет случайных матриц n x n: обратные пакетом и по одной, сравнение */
+void ask_batch_benchmark(void) {
+    size_t n, count;
+    printf("Размер матриц n: ");
+    if (scanf("%zu", &n) != 1 || n == 0) { flush_stdin(); return; }
+    printf("Число матриц в пакете: ");
+    if (scanf("%zu", &count) != 1 || count == 0) { flush_stdin(); return; }
+    MatrixBatch *A = matrix_batch_create(count, n, n);
+    Matrix *m = matrix_create(n, n);
+    int *info = malloc(count * sizeof(int));
+    Matrix **items = calloc(count, sizeof(Matrix *));
+    if (!A || !m || !info || !items) {
+        fprintf(stderr, "Не удалось выделить память\n");
+        matrix_batch_free(A); matrix_free(m); free(info); free(items);
+        return;
+    }
+    for (size_t k = 0; k < count; ++k) {
+        matrix_random(m, -1.0, 1.0);
+        matrix_batch_pack(A, k, m);
+        items[k] = matrix_clone(m);
+    }
+    double t0 = wall_time();
+    MatrixBatch *inv = matrix_batch_inverse(A, info);
+    double t1 = wall_time();
+    size_t singular = 0;
+    double maxdiff = 0.0;
+    for (size_t k = 0; k < count; ++k) {
+        Matrix *r = items[k] ? matrix_inverse(items[k]) : NULL;
+        if (!r) { ++singular; continue; }
+        for (size_t i = 0; inv && info[k] && i < n; ++i)
+            for (size_t j = 0; j < n; ++j) {
+                double d = fabs(r->data[i * n + j] - matrix_batch_get(inv, k, i, j));
+                if (d > maxdiff) maxdiff = d;
+            }
+        matrix_free(r);
+    }
+    double t2 = wall_time();
+    printf("Пакетом: %.3f с (%.0f нс на матрицу)\n", t1 - t0, (t1 - t0) * 1e9 / count);
+    printf("По одной (вместе со сравнением): %.3f с (%.0f нс на матрицу)\n", t2 - t1, (t2 - t1) * 1e9 / count);
+    printf("Вырожденных: %zu, max расхождение: %.3g\n", singular, maxdiff);
+    for (size_t k = 0; k < count; ++k) matrix_free(items[k]);
+    free(items);
+    free(info);
+    matrix_free(m);
+    matrix_batch_free(inv);
+    matrix_batch_free(A);
+}
+
+/* Скорость чтения памяти: поток на узле 0, память на каждом из узлов */
+void ask_numa_benchmark(void) {
+    int nodes = matrix_numa_nodes();
+    size_t mb = 256;
+    printf("NUMA-узлов: %d, потоков: %d\n", nodes, matrix_num_threads());
+    for (int cpu = 0; cpu < nodes; ++cpu)
+        for (int mem = 0; mem < nodes; ++mem) {
+            double gbs = matrix_numa_bandwidth(cpu, mem, mb << 20);
+            if (gbs < 0) printf("поток на узле %d, память на узле %d: не удалось\n", cpu, mem);
+            else printf("поток на узле %d, память на узле %d (%s): %.2f ГБ/с\n",
+                        cpu, mem, cpu == mem ? "локальная" : "удалённая", gbs);
+        }
+    if (nodes == 1) printf("Узел один — удалённой памяти нет, сравнивать не с чем.\n");
+}
+
+/* Сильная масштабируемость LU: одна и та же матрица n x n на 1, 2, 4, ...
+   потоках (до MATRIX_NUM_THREADS), лучшее из двух запусков */
+void ask_scaling_benchmark(void) {
+    size_t n;
+    printf("Размер матрицы n: ");
+    if (scanf("%zu", &n) != 1 || n == 0) { flush_stdin(); return; }
+    Matrix *a = matrix_create(n, n);
+    if (!a) { fprintf(stderr, "Не удалось выделить память\n"); return; }
+    matrix_random(a, -1.0, 1.0);
+    int max = matrix_set_num_threads(0);
+    double flops = 2.0 / 3.0 * (double)n * (double)n * (double)n, base = 0.0;
+    puts(" потоков   время, с   ГФЛОП/с    ускор.    эффект."); // кириллица: ширину %s не задать
+    for (int t = 1; t <= max; t = (t < max && 2 * t > max) ? max : 2 * t) {
+        matrix_set_num_threads(t);
+        double best = 1e300;
+        for (int rep = 0; rep < 2; ++rep) {
+            int sign;
+            double mant;
+            long exp2;
+            double t0 = wall_time();
+            int ok = det_factor(a, MATRIX_GENERAL, &sign, &mant, &exp2);
+            double dt = wall_time() - t0;
+            if (!ok) { best = -1.0; break; }
+            if (dt < best) best = dt;
+        }
+        if (best < 0) { printf("Ошибка: нехватка памяти.\n"); break; }
+        if (t == 1) base = best;
+        printf("%8d %10.3f %9.2f %9.2f %9.0f%%\n", t, best, flops / best * 1e-9,
+               base / best, 100.0 * base / best / t);
+    }
+    matrix_set_num_threads(0);
+    matrix_free(a);
+}
+
 void print_menu(void) {
     puts("\n=== Matrix Toolbox ===");
     puts("1) Создать новую матрицу вручную");
@@ -298,6 +6026,22 @@ void print_menu(void) {
     puts("10) Детерминант (если квадратная)");
     puts("11) Обратная матрица (если квадратная и невырождена)");
     puts("12) Освободить текущую матрицу");
+    puts("13) Разреженный LU: детерминант и решение A x = b");
+    puts("14) Разложение Холецкого (для SPD)");
+    puts("15) Точный детерминант (целочисленная матрица)");
+    puts("16) QR-разложение");
+    puts("17) Метод наименьших квадратов: A X ~ B");
+    puts("18) Собственные значения (симметричная матрица)");
+    puts("19) Усечённое SVD (рандомизированное)");
+    puts("20) Решить A X = B (смешанная точность)");
+    puts("21) Приближённое умножение (int8/int16)");
+    puts("22) Пакет малых матриц: скорость обращения");
+    puts("23) NUMA: скорость чтения локальной и удалённой памяти");
+    puts("24) Суммы, нормы, след, min/max");
+    puts("25) Степень матрицы A^k");
+    puts("26) Матричная экспонента exp(A)");
+    puts("27) Матрица Грама A^T A (SYRK)");
+    puts("28) Масштабируемость LU по числу потоков");
     puts("0) Выход");
     printf("Выберите действие: ");
 }
@@ -332,20 +6076,64 @@ Matrix *ask_create_random(void) {
     return m;
 }
 
-Matrix *ask_load_file(void) {
+/* Загрузка из файла: бинарный формат распознаётся по сигнатуре, иначе текст.
+   В *f32 (если не NULL) — 1, если элементы в файле float32. */
+Matrix *ask_load_file(int *f32) {
     char fname[512];
     printf("Имя файла для загрузки: ");
     scanf("%511s", fname);
-    Matrix *m = matrix_load_txt(fname);
+    if (f32) *f32 = 0;
+    Matrix *m = NULL;
+    if (matrix_file_is_bin(fname)) {
+        MatrixDType dtype;
+        m = matrix_load_bin(fname, &dtype);
+        if (!m) {
+            fprintf(stderr, "Бинарный файл '%s' обрезан или повреждён\n", fname);
+            return NULL;
+        }
+        printf("Бинарный файл, элементы %s\n", dtype == MATRIX_F32 ? "float32" : "float64");
+        if (f32) *f32 = dtype == MATRIX_F32;
+        return m;
+    }
+    m = matrix_load_txt(fname);
     if (!m) fprintf(stderr, "Не удалось загрузить матрицу из '%s'\n", fname);
     return m;
 }
 
+/* Операция для матрицы из float32-файла через MatrixF-ядра:
+   '+', '-', '*' с b или 'T' (транспонирование, b == NULL).
+   Значения a точно представимы в float; результат — снова float32-значения. */
+static Matrix *menu_f32_op(const Matrix *a, const Matrix *b, char op) {
+    MatrixF *fa = matrix_to_float(a), *fb = b ? matrix_to_float(b) : NULL, *fc = NULL;
+    if (fa && (fb || !b)) {
+        switch (op) {
+        case '+': fc = matrixf_add_sub(fa, fb, 0); break;
+        case '-': fc = matrixf_add_sub(fa, fb, 1); break;
+        case '*': fc = matrixf_multiply(fa, fb); break;
+        case 'T': fc = matrixf_transpose(fa); break;
+        }
+    }
+    Matrix *c = fc ? matrixf_to_double(fc) : NULL;
+    matrixf_free(fa);
+    matrixf_free(fb);
+    matrixf_free(fc);
+    return c;
+}
+
 int ask_save_file(const Matrix *m) {
     char fname[512];
+    puts("Формат файла:");
+    puts("1) Текст");
+    puts("2) Бинарный, float64");
+    puts("3) Бинарный, float32 (вдвое меньше, ~7 значащих цифр)");
+    printf("Выбор: ");
+    int fmt;
+    while (scanf("%d", &fmt) != 1 || fmt < 1 || fmt > 3) { flush_stdin(); printf("Неверно. Выберите 1, 2 или 3: "); }
     printf("Имя файла для сохранения: ");
     scanf("%511s", fname);
-    if (matrix_save_txt(m, fname)) {
+    int ok = fmt == 1 ? matrix_save_txt(m, fname)
+                      : matrix_save_bin(m, fname, fmt == 3 ? MATRIX_F32 : MATRIX_F64);
+    if (ok) {
         printf("Сохранено в '%s'\n", fname);
         return 1;
     } else {
@@ -364,13 +6152,67 @@ Matrix *ask_other_matrix_for_operation(void) {
     if (scanf("%d", &choice) != 1) { flush_stdin(); return NULL; }
     if (choice == 1) return ask_create_manual();
     if (choice == 2) return ask_create_random();
-    if (choice == 3) return ask_load_file();
+    if (choice == 3) return ask_load_file(NULL);
     return NULL;
 }
 
+/* Разреженный LU для текущей матрицы или матрицы из файла триплетов */
+void ask_sparse_lu(const Matrix *M) {
+    puts("Источник разреженной матрицы:");
+    puts("1) Текущая матрица");
+    puts("2) Файл с триплетами (rows cols nnz / i j value)");
+    printf("Выбор: ");
+    int choice;
+    if (scanf("%d", &choice) != 1) { flush_stdin(); return; }
+    SparseMatrix *S = NULL;
+    if (choice == 1) {
+        if (!M) { printf("Нет текущей матрицы.\n"); return; }
+        S = sparse_from_dense(M, 0.0);
+    } else if (choice == 2) {
+        char fname[512];
+        printf("Имя файла: ");
+        scanf("%511s", fname);
+        S = sparse_load_txt(fname);
+        if (!S) { fprintf(stderr, "Не удалось загрузить матрицу из '%s'\n", fname); return; }
+    } else {
+        return;
+    }
+    if (!S) { fprintf(stderr, "Не удалось выделить память\n"); return; }
+    if (S->rows != S->cols) { printf("Не квадратная матрица.\n"); sparse_free(S); return; }
+    SparseLUSymbolic *sym = sparse_lu_symbolic(S);
+    SparseLUNumeric *f = sym ? sparse_lu_numeric(S, sym) : NULL;
+    if (!f) {
+        printf("Матрица вырождена или ошибка памяти. Детерминант = 0\n");
+    } else {
+        printf("nnz(A) = %zu, nnz(L) = %zu, nnz(U) = %zu\n",
+               S->nnz, f->lp[f->n], f->up[f->n] + f->n);
+        int sign;
+        double logdet = sparse_lu_logdet(f, &sign);
+        printf("Детерминант = %.12g\n", sparse_lu_determinant(f));
+        printf("log|det| = %.12g, знак = %+d\n", logdet, sign);
+        printf("Решить A x = b? (1 - да, 0 - нет): ");
+        int yes = 0;
+        if (scanf("%d", &yes) == 1 && yes == 1) {
+            Matrix *B = ask_other_matrix_for_operation();
+            if (!B || B->rows != S->rows || B->cols != 1) {
+                printf("Нужен вектор-столбец %zux1.\n", S->rows);
+            } else {
+                sparse_lu_solve(f, B->data);
+                printf("Решение x:\n");
+                matrix_print(B);
+            }
+            matrix_free(B);
+        }
+    }
+    sparse_lu_numeric_free(f);
+    sparse_lu_symbolic_free(sym);
+    sparse_free(S);
+}
+
 int main(void) {
     srand((unsigned)time(NULL));
     Matrix *M = NULL;
+    int f32 = 0; // M загружена из float32-файла: + - * и транспонирование в float
     int running = 1;
     while (running) {
         print_menu();
@@ -380,14 +6222,16 @@ int main(void) {
             case 1:
                 if (M) { matrix_free(M); M = NULL; }
                 M = ask_create_manual();
+                f32 = 0;
                 break;
             case 2:
                 if (M) { matrix_free(M); M = NULL; }
                 M = ask_create_random();
+                f32 = 0;
                 break;
             case 3:
                 if (M) { matrix_free(M); M = NULL; }
-                M = ask_load_file();
+                M = ask_load_file(&f32);
                 break;
             case 4:
                 if (!M) printf("Текущая матрица отсутствует.\n");
@@ -401,7 +6245,7 @@ int main(void) {
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
                 Matrix *B = ask_other_matrix_for_operation();
                 if (!B) { printf("Операция отменена.\n"); break; }
-                Matrix *C = matrix_add_sub(M, B, 0);
+                Matrix *C = f32 ? menu_f32_op(M, B, '+') : matrix_add_sub(M, B, 0);
                 if (!C) printf("Ошибка: несовместимые размеры или память.\n");
                 else { printf("Результат (сложение):\n"); matrix_print(C); matrix_free(C); }
                 matrix_free(B);
@@ -411,7 +6255,7 @@ int main(void) {
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
                 Matrix *B = ask_other_matrix_for_operation();
                 if (!B) { printf("Операция отменена.\n"); break; }
-                Matrix *C = matrix_add_sub(M, B, 1);
+                Matrix *C = f32 ? menu_f32_op(M, B, '-') : matrix_add_sub(M, B, 1);
                 if (!C) printf("Ошибка: несовместимые размеры или память.\n");
                 else { printf("Результат (вычитание):\n"); matrix_print(C); matrix_free(C); }
                 matrix_free(B);
@@ -421,7 +6265,7 @@ int main(void) {
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
                 Matrix *B = ask_other_matrix_for_operation();
                 if (!B) { printf("Операция отменена.\n"); break; }
-                Matrix *C = matrix_multiply(M, B);
+                Matrix *C = f32 ? menu_f32_op(M, B, '*') : matrix_multiply(M, B);
                 if (!C) printf("Ошибка: несовместимые размеры или память.\n");
                 else { printf("Результат (умножение):\n"); matrix_print(C); matrix_free(C); }
                 matrix_free(B);
@@ -429,7 +6273,7 @@ int main(void) {
             }
             case 9: { // transpose
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
-                Matrix *T = matrix_transpose(M);
+                Matrix *T = f32 ? menu_f32_op(M, NULL, 'T') : matrix_transpose(M);
                 if (!T) printf("Ошибка: память.\n");
                 else {
                     matrix_free(M);
@@ -441,22 +6285,229 @@ int main(void) {
             case 10: { // determinant
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
                 if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
-                double det = matrix_determinant(M);
-                printf("Детерминант = %.12g\n", det);
+                // одно разложение: det = sign * mant * 2^exp2
+                int sign;
+                double mant;
+                long exp2;
+                if (!det_factor(M, MATRIX_AUTO, &sign, &mant, &exp2)) { printf("Ошибка: память.\n"); break; }
+                if (sign == 0) { printf("Детерминант = 0\n"); break; }
+                long e = exp2 > INT_MAX ? INT_MAX : exp2 < INT_MIN ? INT_MIN : exp2;
+                printf("Детерминант = %.12g\n", sign * ldexp(mant, (int)e));
+                printf("log|det| = %.12g, знак = %+d\n", log(mant) + (double)exp2 * log(2.0), sign);
                 break;
             }
             case 11: { // inverse
                 if (!M) { printf("Нет текущей матрицы.\n"); break; }
                 if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
-                Matrix *inv = matrix_inverse(M);
+                double rc;
+                Matrix *inv = matrix_inverse_cond(M, &rc);
                 if (!inv) printf("Матрица необратима или ошибка.\n");
                 else { printf("Обратная матрица:\n"); matrix_print(inv); matrix_free(inv); }
+                if (rc >= 0.0) {
+                    printf("Оценка rcond_1 = %.3g (cond_1 ~ %.3g)\n", rc, rc > 0.0 ? 1.0 / rc : INFINITY);
+                    if (rc < (double)M->rows * DBL_EPSILON)
+                        printf("Внимание: матрица плохо обусловлена, результату доверять нельзя.\n");
+                }
                 break;
             }
             case 12:
-                if (M) { matrix_free(M); M = NULL; printf("Матрица освобождена.\n"); }
+                if (M) { matrix_free(M); M = NULL; f32 = 0; printf("Матрица освобождена.\n"); }
                 else printf("Матрица отсутствует.\n");
                 break;
+            case 13:
+                ask_sparse_lu(M);
+                break;
+            case 14: { // cholesky
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                Matrix *L = matrix_cholesky(M);
+                if (!L) { printf("Матрица не является симметричной положительно определённой.\n"); break; }
+                double logdet = 0.0;
+                for (size_t i = 0; i < L->rows; ++i) logdet += 2.0 * log(matrix_get(L, i, i));
+                printf("Множитель L (A = L L^T):\n");
+                matrix_print(L);
+                printf("log det = %.12g\n", logdet);
+                matrix_free(L);
+                break;
+            }
+            case 15: { // exact determinant
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                char *det = matrix_det_exact(M);
+                if (!det) printf("Матрица не целочисленная или ошибка памяти.\n");
+                else { printf("Детерминант (точно) = %s\n", det); free(det); }
+                break;
+            }
+            case 16: { // QR
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                Matrix *Q = NULL, *R = NULL;
+                if (!matrix_qr(M, &Q, &R)) { printf("Ошибка: память.\n"); break; }
+                printf("Q:\n");
+                matrix_print(Q);
+                printf("R:\n");
+                matrix_print(R);
+                matrix_free(Q);
+                matrix_free(R);
+                break;
+            }
+            case 17: { // least squares
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                Matrix *B = ask_other_matrix_for_operation();
+                if (!B) { printf("Операция отменена.\n"); break; }
+                Matrix *X = matrix_lstsq(M, B);
+                if (!X) printf("Ошибка: несовместимые размеры, неполный ранг или память.\n");
+                else { printf("Решение X:\n"); matrix_print(X); matrix_free(X); }
+                matrix_free(B);
+                break;
+            }
+            case 18: { // symmetric eigenproblem
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                printf("Вычислять собственные векторы? (1 - да, 0 - нет): ");
+                int want = 0;
+                if (scanf("%d", &want) != 1) { flush_stdin(); want = 0; }
+                double *w = malloc((M->rows ? M->rows : 1) * sizeof(double));
+                Matrix *V = NULL;
+                if (!w || !matrix_eigen_sym(M, w, want == 1 ? &V : NULL)) {
+                    printf("Ошибка: память или нет сходимости.\n");
+                } else {
+                    printf("Собственные значения:\n");
+                    for (size_t i = 0; i < M->rows; ++i) printf("%10.6g\n", w[i]);
+                    if (V) { printf("Собственные векторы (по столбцам):\n"); matrix_print(V); }
+                }
+                matrix_free(V);
+                free(w);
+                break;
+            }
+            case 19: { // randomized SVD
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                size_t k;
+                printf("Ранг k: ");
+                while (scanf("%zu", &k) != 1) { flush_stdin(); printf("Неверно. Введите ранг k: "); }
+                double *sv = malloc((k ? k : 1) * sizeof(double));
+                Matrix *U = NULL, *V = NULL;
+                if (!sv || !matrix_svd_randomized(M, k, 10, 2, &U, sv, &V)) {
+                    printf("Ошибка: k должно быть от 1 до min(rows, cols), или нехватка памяти.\n");
+                } else {
+                    printf("Сингулярные числа:\n");
+                    for (size_t i = 0; i < k; ++i) printf("%10.6g\n", sv[i]);
+                    printf("U:\n");
+                    matrix_print(U);
+                    printf("V:\n");
+                    matrix_print(V);
+                }
+                matrix_free(U);
+                matrix_free(V);
+                free(sv);
+                break;
+            }
+            case 20: { // mixed-precision solve
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                Matrix *B = ask_other_matrix_for_operation();
+                if (!B) { printf("Операция отменена.\n"); break; }
+                int iters;
+                Matrix *X = matrix_solve_mixed(M, B, &iters);
+                if (!X) printf("Ошибка: несовместимые размеры, вырожденная матрица или память.\n");
+                else {
+                    if (iters >= 0) printf("Итераций уточнения: %d\n", iters);
+                    else printf("Уточнение не сошлось, решено в double.\n");
+                    printf("Решение X:\n");
+                    matrix_print(X);
+                    matrix_free(X);
+                }
+                matrix_free(B);
+                break;
+            }
+            case 21: { // quantized multiply
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                printf("Разрядность (8 или 16): ");
+                int bits;
+                if (scanf("%d", &bits) != 1 || (bits != 8 && bits != 16)) { flush_stdin(); printf("Нужно 8 или 16.\n"); break; }
+                Matrix *B = ask_other_matrix_for_operation();
+                if (!B) { printf("Операция отменена.\n"); break; }
+                double err;
+                Matrix *C = matrix_multiply_quantized(M, B, bits, &err);
+                if (!C) printf("Ошибка: несовместимые размеры или память.\n");
+                else {
+                    printf("Результат (int%d):\n", bits);
+                    matrix_print(C);
+                    printf("Относительная ошибка max|C - C_q| / max|C| = %.3g\n", err);
+                    matrix_free(C);
+                }
+                matrix_free(B);
+                break;
+            }
+            case 22:
+                ask_batch_benchmark();
+                break;
+            case 23:
+                ask_numa_benchmark();
+                break;
+            case 24: { // reductions
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                printf("Сумма = %.12g, среднее = %.12g, min = %.12g, max = %.12g\n",
+                       matrix_reduce_all(M, MATRIX_SUM), matrix_reduce_all(M, MATRIX_MEAN),
+                       matrix_reduce_all(M, MATRIX_MIN), matrix_reduce_all(M, MATRIX_MAX));
+                printf("||A||_1 = %.12g, ||A||_inf = %.12g, ||A||_F = %.12g\n",
+                       matrix_norm(M, '1'), matrix_norm(M, 'I'), matrix_norm(M, 'F'));
+                if (M->rows == M->cols) printf("След = %.12g\n", matrix_trace(M));
+                Matrix *rs = matrix_reduce(M, 1, MATRIX_SUM), *cs = matrix_reduce(M, 0, MATRIX_SUM);
+                printf("Суммы по строкам:\n");
+                matrix_print(rs);
+                printf("Суммы по столбцам:\n");
+                matrix_print(cs);
+                matrix_free(rs);
+                matrix_free(cs);
+                break;
+            }
+            case 25: { // power
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                long k;
+                printf("Показатель k (отрицательный — степень обратной): ");
+                if (scanf("%ld", &k) != 1) { flush_stdin(); printf("Неверный ввод.\n"); break; }
+                double t0 = wall_time();
+                Matrix *P = matrix_power(M, k);
+                double t1 = wall_time();
+                if (!P) printf("Ошибка: матрица вырождена или нехватка памяти.\n");
+                else {
+                    printf("A^%ld (%.3f с):\n", k, t1 - t0);
+                    matrix_print(P);
+                    matrix_free(P);
+                }
+                break;
+            }
+            case 26: { // expm
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                if (M->rows != M->cols) { printf("Не квадратная матрица.\n"); break; }
+                double t0 = wall_time();
+                Matrix *E = matrix_expm(M);
+                double t1 = wall_time();
+                if (!E) printf("Ошибка: не конечные элементы или нехватка памяти.\n");
+                else {
+                    printf("exp(A) (%.3f с):\n", t1 - t0);
+                    matrix_print(E);
+                    matrix_free(E);
+                }
+                break;
+            }
+            case 27: { // gram
+                if (!M) { printf("Нет текущей матрицы.\n"); break; }
+                double t0 = wall_time();
+                Matrix *G = matrix_ata(M);
+                double t1 = wall_time();
+                if (!G) printf("Ошибка: память.\n");
+                else {
+                    printf("A^T A (%.3f с):\n", t1 - t0);
+                    matrix_print(G);
+                    matrix_free(G);
+                }
+                break;
+            }
+            case 28:
+                ask_scaling_benchmark();
+                break;
             case 0:
                 running = 0;
                 break;
@@ -470,3 +6521,4 @@ int main(void) {
     return 0;
 }
 
+#endif // MATRIX_NO_MAIN
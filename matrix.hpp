@@ -0,0 +1,523 @@
+/* matrix.hpp
+   Заголовочная C++17-обёртка над matrix.c.
+   Сборка: ядра — из того же matrix.c, без меню:
+     gcc -std=c11 -O2 -c -DMATRIX_NO_MAIN matrix.c
+     g++ -std=c++17 -O2 app.cpp matrix.o -pthread -lm
+
+   cmatrix::Matrix           — владеет capi::Matrix* (RAII), перемещение без копий;
+   cmatrix::FixedMatrix<R,C> — размер известен при компиляции, до
+                               CMATRIX_STACK_BYTES данные на стеке;
+   поэлементные + - (унарный и бинарный), * и / на скаляр, hadamard —
+   шаблоны выражений: A + 2 * B - C считается одним проходом при
+   присваивании, без промежуточных матриц. Простые A + B, A - B,
+   hadamard(A, B) и s * A уходят в C-ядра (matrix_*_into: потоки и запись
+   мимо кэша), остальные выражения считаются кусками в пуле потоков
+   через matrix_parallel_for. Умножение матриц, обратная,
+   детерминант и решение систем вызывают C-ядра (matrix_gemm и т.д.).
+   Выражения ссылаются на операнды — не сохраняйте их в auto дольше
+   одного оператора.
+   Ошибки: несовместимые размеры — std::invalid_argument, вырожденная
+   матрица — std::domain_error, нехватка памяти — std::bad_alloc.
+*/
+
+#ifndef CMATRIX_MATRIX_HPP
+#define CMATRIX_MATRIX_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/* Объявления из matrix.c (раскладка Matrix должна совпадать с ним).
+   В пространстве имён cmatrix::capi, чтобы C-шный Matrix не конфликтовал
+   с cmatrix::Matrix; символы те же — связывание C. */
+namespace cmatrix {
+namespace capi {
+extern "C" {
+typedef struct {
+    size_t rows;
+    size_t cols;
+    double *data;
+} Matrix;
+
+Matrix *matrix_create(size_t rows, size_t cols);
+void matrix_free(Matrix *m);
+Matrix *matrix_clone(const Matrix *a);
+void matrix_print(const Matrix *m);
+void matrix_gemm(int ta, int tb, size_t m, size_t n, size_t k,
+                 double alpha, const double *A, size_t lda,
+                 const double *B, size_t ldb,
+                 double beta, double *C, size_t ldc);
+Matrix *matrix_transpose(const Matrix *a);
+int matrix_add_sub_into(const Matrix *a, const Matrix *b, int subtract, Matrix *out);
+int matrix_hadamard_into(const Matrix *a, const Matrix *b, Matrix *out);
+int matrix_scale_into(const Matrix *a, double s, Matrix *out);
+void matrix_parallel_for(size_t n, size_t grain, void (*fn)(size_t lo, size_t hi, void *ctx), void *ctx);
+double matrix_determinant(const Matrix *a);
+Matrix *matrix_inverse(const Matrix *a);
+Matrix *matrix_solve(const Matrix *a, const Matrix *b);
+int matrix_save_txt(const Matrix *m, const char *filename);
+Matrix *matrix_load_txt(const char *filename);
+}
+} // namespace capi
+} // namespace cmatrix
+
+#ifndef CMATRIX_STACK_BYTES
+#define CMATRIX_STACK_BYTES 4096
+#endif
+
+namespace cmatrix {
+
+class Matrix;
+template <std::size_t R, std::size_t C> class FixedMatrix;
+
+namespace detail {
+
+/* База CRTP: всё, у чего есть rows(), cols() и operator[](k) по
+   построчному индексу k = i * cols + j */
+template <class E> struct Expr {
+    const E &self() const { return static_cast<const E &>(*this); }
+};
+
+template <class T> struct is_leaf : std::false_type {};
+template <> struct is_leaf<Matrix> : std::true_type {};
+template <std::size_t R, std::size_t C> struct is_leaf<FixedMatrix<R, C>> : std::true_type {};
+
+// листья хранятся по ссылке, узлы выражения — по значению
+template <class T>
+using operand_t = std::conditional_t<is_leaf<T>::value, const T &, const T>;
+
+struct Add { static double apply(double a, double b) { return a + b; } };
+struct Sub { static double apply(double a, double b) { return a - b; } };
+struct Mul { static double apply(double a, double b) { return a * b; } };
+
+template <class L, class R, class Op>
+class Binary : public Expr<Binary<L, R, Op>> {
+public:
+    Binary(const L &l, const R &r) : l_(l), r_(r) {
+        if (l.rows() != r.rows() || l.cols() != r.cols())
+            throw std::invalid_argument("cmatrix: size mismatch");
+    }
+    std::size_t rows() const { return l_.rows(); }
+    std::size_t cols() const { return l_.cols(); }
+    double operator[](std::size_t k) const { return Op::apply(l_[k], r_[k]); }
+    const L &left() const { return l_; }
+    const R &right() const { return r_; }
+
+private:
+    operand_t<L> l_;
+    operand_t<R> r_;
+};
+
+template <class E>
+class Scaled : public Expr<Scaled<E>> {
+public:
+    Scaled(double s, const E &e) : s_(s), e_(e) {}
+    std::size_t rows() const { return e_.rows(); }
+    std::size_t cols() const { return e_.cols(); }
+    double operator[](std::size_t k) const { return s_ * e_[k]; }
+    double scale() const { return s_; }
+    const E &operand() const { return e_; }
+
+private:
+    double s_;
+    operand_t<E> e_;
+};
+
+/* Присваивание out = x. Листовые случаи идут в C-ядра; kernel_assign
+   возвращает false, если подходящего ядра нет. */
+template <class M> capi::Matrix view_of(const M &m) {
+    return capi::Matrix{m.rows(), m.cols(), const_cast<double *>(m.data())};
+}
+
+template <class E> bool kernel_assign(const E &, capi::Matrix *) { return false; }
+
+template <class L, class R>
+std::enable_if_t<is_leaf<L>::value && is_leaf<R>::value, bool>
+kernel_assign(const Binary<L, R, Add> &e, capi::Matrix *out) {
+    capi::Matrix a = view_of(e.left()), b = view_of(e.right());
+    return capi::matrix_add_sub_into(&a, &b, 0, out);
+}
+
+template <class L, class R>
+std::enable_if_t<is_leaf<L>::value && is_leaf<R>::value, bool>
+kernel_assign(const Binary<L, R, Sub> &e, capi::Matrix *out) {
+    capi::Matrix a = view_of(e.left()), b = view_of(e.right());
+    return capi::matrix_add_sub_into(&a, &b, 1, out);
+}
+
+template <class L, class R>
+std::enable_if_t<is_leaf<L>::value && is_leaf<R>::value, bool>
+kernel_assign(const Binary<L, R, Mul> &e, capi::Matrix *out) {
+    capi::Matrix a = view_of(e.left()), b = view_of(e.right());
+    return capi::matrix_hadamard_into(&a, &b, out);
+}
+
+template <class E>
+std::enable_if_t<is_leaf<E>::value, bool> kernel_assign(const Scaled<E> &e, capi::Matrix *out) {
+    capi::Matrix a = view_of(e.operand());
+    return capi::matrix_scale_into(&a, e.scale(), out);
+}
+
+// Слитое выражение: куски [lo, hi) считаются в пуле matrix.c
+template <class E> struct FusedAssign {
+    const E &x;
+    double *d;
+    static void run(std::size_t lo, std::size_t hi, void *ctx) {
+        const FusedAssign *f = static_cast<const FusedAssign *>(ctx);
+        for (std::size_t k = lo; k < hi; ++k) f->d[k] = f->x[k];
+    }
+};
+
+// безопасно при A = A + B: элемент k читается только из позиций k
+template <class E> void assign(const E &x, capi::Matrix *out) {
+    if (kernel_assign(x, out)) return;
+    FusedAssign<E> f{x, out->data};
+    capi::matrix_parallel_for(out->rows * out->cols, 0, &FusedAssign<E>::run, &f);
+}
+
+inline void check_product(std::size_t ac, std::size_t br) {
+    if (ac != br) throw std::invalid_argument("cmatrix: inner dimensions differ");
+}
+
+} // namespace detail
+
+/* ====== Matrix: динамический размер, владеет capi::Matrix ====== */
+
+class Matrix : public detail::Expr<Matrix> {
+public:
+    Matrix() noexcept = default;
+
+    Matrix(std::size_t rows, std::size_t cols) : m_(capi::matrix_create(rows, cols)) {
+        if (!m_) throw std::bad_alloc();
+    }
+
+    Matrix(std::size_t rows, std::size_t cols, std::initializer_list<double> values) : Matrix(rows, cols) {
+        if (values.size() != rows * cols) throw std::invalid_argument("cmatrix: wrong number of values");
+        std::copy(values.begin(), values.end(), m_->data);
+    }
+
+    // Принимает владение указателем, полученным из C-API (NULL -> bad_alloc)
+    static Matrix adopt(capi::Matrix *m) {
+        if (!m) throw std::bad_alloc();
+        Matrix r;
+        r.m_ = m;
+        return r;
+    }
+
+    static Matrix identity(std::size_t n) {
+        Matrix r(n, n);
+        for (std::size_t i = 0; i < n; ++i) r(i, i) = 1.0;
+        return r;
+    }
+
+    static Matrix load(const char *filename) {
+        capi::Matrix *m = capi::matrix_load_txt(filename);
+        if (!m) throw std::runtime_error("cmatrix: cannot load matrix");
+        return adopt(m);
+    }
+
+    Matrix(const Matrix &o) : m_(o.m_ ? capi::matrix_clone(o.m_) : nullptr) {
+        if (o.m_ && !m_) throw std::bad_alloc();
+    }
+    Matrix(Matrix &&o) noexcept : m_(std::exchange(o.m_, nullptr)) {}
+
+    Matrix &operator=(const Matrix &o) {
+        if (this != &o) *this = Matrix(o);
+        return *this;
+    }
+    Matrix &operator=(Matrix &&o) noexcept {
+        std::swap(m_, o.m_);
+        return *this;
+    }
+
+    ~Matrix() { capi::matrix_free(m_); }
+
+    // Вычисление выражения одним проходом
+    template <class E>
+    Matrix(const detail::Expr<E> &e) : Matrix(e.self().rows(), e.self().cols()) {
+        assign(e.self());
+    }
+
+    template <class E>
+    Matrix &operator=(const detail::Expr<E> &e) {
+        const E &x = e.self();
+        if (!m_ || rows() != x.rows() || cols() != x.cols()) {
+            Matrix tmp(x);
+            return *this = std::move(tmp);
+        }
+        assign(x);
+        return *this;
+    }
+
+    template <class E>
+    Matrix &operator+=(const detail::Expr<E> &e) { return *this = *this + e.self(); }
+    template <class E>
+    Matrix &operator-=(const detail::Expr<E> &e) { return *this = *this - e.self(); }
+    Matrix &operator*=(double s) {
+        for (std::size_t k = 0; k < size(); ++k) m_->data[k] *= s;
+        return *this;
+    }
+
+    std::size_t rows() const noexcept { return m_ ? m_->rows : 0; }
+    std::size_t cols() const noexcept { return m_ ? m_->cols : 0; }
+    std::size_t size() const noexcept { return rows() * cols(); }
+    bool empty() const noexcept { return size() == 0; }
+
+    double *data() noexcept { return m_ ? m_->data : nullptr; }
+    const double *data() const noexcept { return m_ ? m_->data : nullptr; }
+    double &operator()(std::size_t i, std::size_t j) { return m_->data[i * m_->cols + j]; }
+    double operator()(std::size_t i, std::size_t j) const { return m_->data[i * m_->cols + j]; }
+    double operator[](std::size_t k) const { return m_->data[k]; }
+
+    // Доступ к C-структуре для вызова остальных функций matrix.c
+    capi::Matrix *get() noexcept { return m_; }
+    const capi::Matrix *get() const noexcept { return m_; }
+    capi::Matrix *release() noexcept { return std::exchange(m_, nullptr); }
+
+    Matrix transpose() const { return adopt(capi::matrix_transpose(require())); }
+
+    double determinant() const {
+        const capi::Matrix *a = require();
+        if (a->rows != a->cols) throw std::invalid_argument("cmatrix: determinant of non-square matrix");
+        return capi::matrix_determinant(a);
+    }
+
+    Matrix inverse() const {
+        const capi::Matrix *a = require();
+        if (a->rows != a->cols) throw std::invalid_argument("cmatrix: inverse of non-square matrix");
+        capi::Matrix *r = capi::matrix_inverse(a);
+        if (!r) throw std::domain_error("cmatrix: singular matrix");
+        return adopt(r);
+    }
+
+    // X из A X = B
+    Matrix solve(const Matrix &b) const {
+        const capi::Matrix *a = require();
+        if (a->rows != a->cols || b.rows() != a->rows)
+            throw std::invalid_argument("cmatrix: solve size mismatch");
+        capi::Matrix *r = capi::matrix_solve(a, b.require());
+        if (!r) throw std::domain_error("cmatrix: singular matrix");
+        return adopt(r);
+    }
+
+    void save(const char *filename) const {
+        if (!capi::matrix_save_txt(require(), filename)) throw std::runtime_error("cmatrix: cannot save matrix");
+    }
+
+    void print() const { capi::matrix_print(m_); }
+
+private:
+    template <class E> void assign(const E &x) { detail::assign(x, m_); }
+
+    const capi::Matrix *require() const {
+        if (!m_) throw std::invalid_argument("cmatrix: empty matrix");
+        return m_;
+    }
+
+    capi::Matrix *m_ = nullptr;
+};
+
+/* ====== FixedMatrix<R, C>: размер — параметр шаблона ====== */
+
+namespace detail {
+
+template <std::size_t N, bool OnStack> struct FixedStorage;
+
+template <std::size_t N> struct FixedStorage<N, true> {
+    std::array<double, N> a{};
+    double *data() noexcept { return a.data(); }
+    const double *data() const noexcept { return a.data(); }
+};
+
+// большие FixedMatrix — в куче, но с теми же размерами времени компиляции
+template <std::size_t N> struct FixedStorage<N, false> {
+    std::unique_ptr<double[]> p{new double[N]()};
+    FixedStorage() = default;
+    FixedStorage(const FixedStorage &o) : p(new double[N]()) { copy_from(o); }
+    FixedStorage(FixedStorage &&) noexcept = default;
+    // после перемещения p пуст: присваивание заново выделяет буфер
+    FixedStorage &operator=(const FixedStorage &o) {
+        if (this != &o) {
+            ensure();
+            copy_from(o);
+        }
+        return *this;
+    }
+    FixedStorage &operator=(FixedStorage &&o) noexcept {
+        std::swap(p, o.p);
+        return *this;
+    }
+    double *data() noexcept { return p.get(); }
+    const double *data() const noexcept { return p.get(); }
+    void ensure() {
+        if (!p) p.reset(new double[N]());
+    }
+
+private:
+    void copy_from(const FixedStorage &o) {
+        if (o.p) std::memcpy(p.get(), o.p.get(), N * sizeof(double));
+        else std::fill(p.get(), p.get() + N, 0.0);
+    }
+};
+
+} // namespace detail
+
+template <std::size_t R, std::size_t C>
+class FixedMatrix : public detail::Expr<FixedMatrix<R, C>> {
+public:
+    static constexpr bool on_stack = R * C * sizeof(double) <= CMATRIX_STACK_BYTES;
+
+    FixedMatrix() = default;
+
+    FixedMatrix(std::initializer_list<double> values) {
+        if (values.size() != R * C) throw std::invalid_argument("cmatrix: wrong number of values");
+        std::copy(values.begin(), values.end(), s_.data());
+    }
+
+    template <class E>
+    FixedMatrix(const detail::Expr<E> &e) { *this = e; }
+
+    template <class E>
+    FixedMatrix &operator=(const detail::Expr<E> &e) {
+        const E &x = e.self();
+        if (x.rows() != R || x.cols() != C) throw std::invalid_argument("cmatrix: size mismatch");
+        if constexpr (!on_stack) {
+            s_.ensure();
+            capi::Matrix out = view();
+            detail::assign(x, &out);
+        } else {
+            double *d = s_.data();
+            for (std::size_t k = 0; k < R * C; ++k) d[k] = x[k];
+        }
+        return *this;
+    }
+
+    static FixedMatrix identity() {
+        static_assert(R == C, "identity() needs a square matrix");
+        FixedMatrix r;
+        for (std::size_t i = 0; i < R; ++i) r(i, i) = 1.0;
+        return r;
+    }
+
+    static constexpr std::size_t rows() noexcept { return R; }
+    static constexpr std::size_t cols() noexcept { return C; }
+    static constexpr std::size_t size() noexcept { return R * C; }
+
+    double *data() noexcept { return s_.data(); }
+    const double *data() const noexcept { return s_.data(); }
+    double &operator()(std::size_t i, std::size_t j) { return s_.data()[i * C + j]; }
+    double operator()(std::size_t i, std::size_t j) const { return s_.data()[i * C + j]; }
+    double operator[](std::size_t k) const { return s_.data()[k]; }
+
+    // Невладеющее представление для функций matrix.c (без копирования)
+    capi::Matrix view() const noexcept { return capi::Matrix{R, C, const_cast<double *>(s_.data())}; }
+
+    FixedMatrix<C, R> transpose() const {
+        FixedMatrix<C, R> t;
+        for (std::size_t i = 0; i < R; ++i)
+            for (std::size_t j = 0; j < C; ++j) t(j, i) = (*this)(i, j);
+        return t;
+    }
+
+    double determinant() const {
+        static_assert(R == C, "determinant() needs a square matrix");
+        capi::Matrix v = view();
+        return capi::matrix_determinant(&v);
+    }
+
+    FixedMatrix inverse() const {
+        static_assert(R == C, "inverse() needs a square matrix");
+        capi::Matrix v = view();
+        capi::Matrix *r = capi::matrix_inverse(&v);
+        if (!r) throw std::domain_error("cmatrix: singular matrix");
+        FixedMatrix out;
+        std::memcpy(out.data(), r->data, R * C * sizeof(double));
+        capi::matrix_free(r);
+        return out;
+    }
+
+private:
+    detail::FixedStorage<R * C, on_stack> s_;
+};
+
+/* ====== Поэлементные операции (шаблоны выражений) ====== */
+
+template <class L, class R>
+detail::Binary<L, R, detail::Add> operator+(const detail::Expr<L> &l, const detail::Expr<R> &r) {
+    return {l.self(), r.self()};
+}
+
+template <class L, class R>
+detail::Binary<L, R, detail::Sub> operator-(const detail::Expr<L> &l, const detail::Expr<R> &r) {
+    return {l.self(), r.self()};
+}
+
+// Поэлементное (Адамарово) произведение
+template <class L, class R>
+detail::Binary<L, R, detail::Mul> hadamard(const detail::Expr<L> &l, const detail::Expr<R> &r) {
+    return {l.self(), r.self()};
+}
+
+template <class E>
+detail::Scaled<E> operator*(double s, const detail::Expr<E> &e) { return {s, e.self()}; }
+template <class E>
+detail::Scaled<E> operator*(const detail::Expr<E> &e, double s) { return {s, e.self()}; }
+template <class E>
+detail::Scaled<E> operator/(const detail::Expr<E> &e, double s) { return {1.0 / s, e.self()}; }
+template <class E>
+detail::Scaled<E> operator-(const detail::Expr<E> &e) { return {-1.0, e.self()}; }
+
+/* ====== Матричное умножение через matrix_gemm ====== */
+
+namespace detail {
+
+// Лист используется на месте, выражение сначала вычисляется в Matrix
+template <class E> struct Operand {
+    explicit Operand(const E &e) : tmp(e) {}
+    const double *data() const { return tmp.data(); }
+    Matrix tmp;
+};
+template <> struct Operand<Matrix> {
+    explicit Operand(const Matrix &m) : ref(m) {}
+    const double *data() const { return ref.data(); }
+    const Matrix &ref;
+};
+template <std::size_t R, std::size_t C> struct Operand<FixedMatrix<R, C>> {
+    explicit Operand(const FixedMatrix<R, C> &m) : ref(m) {}
+    const double *data() const { return ref.data(); }
+    const FixedMatrix<R, C> &ref;
+};
+
+} // namespace detail
+
+template <class L, class R>
+Matrix operator*(const detail::Expr<L> &l, const detail::Expr<R> &r) {
+    const L &a = l.self();
+    const R &b = r.self();
+    detail::check_product(a.cols(), b.rows());
+    detail::Operand<L> pa(a);
+    detail::Operand<R> pb(b);
+    Matrix c(a.rows(), b.cols());
+    capi::matrix_gemm(0, 0, a.rows(), b.cols(), a.cols(), 1.0, pa.data(), a.cols(),
+                  pb.data(), b.cols(), 0.0, c.data(), b.cols());
+    return c;
+}
+
+// Размеры известны — результат тоже FixedMatrix, без выделения памяти
+template <std::size_t R, std::size_t K, std::size_t C>
+FixedMatrix<R, C> operator*(const FixedMatrix<R, K> &a, const FixedMatrix<K, C> &b) {
+    FixedMatrix<R, C> c;
+    capi::matrix_gemm(0, 0, R, C, K, 1.0, a.data(), K, b.data(), C, 0.0, c.data(), C);
+    return c;
+}
+
+} // namespace cmatrix
+
+#endif // CMATRIX_MATRIX_HPP